@@ -9,18 +9,32 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    autocompressor.cpp \
+    bwtcompressor.cpp \
+    containercompressor.cpp \
     datastructures.cpp \
     huffmancompressor.cpp \
+    huffmanpresets.cpp \
+    lz77compressor.cpp \
+    lzhuffmancompressor.cpp \
     lzwcompressor.cpp \
     main.cpp \
     mainwindow.cpp \
+    ranscoder.cpp \
     rlecompressor.cpp
 
 HEADERS += \
+    autocompressor.h \
+    bwtcompressor.h \
+    containercompressor.h \
     datastructures.h \
     huffmancompressor.h \
+    huffmanpresets.h \
+    lz77compressor.h \
+    lzhuffmancompressor.h \
     lzwcompressor.h \
     mainwindow.h \
+    ranscoder.h \
     rlecompressor.h
 
 
@@ -0,0 +1,181 @@
+#include "autocompressor.h"
+#include <cmath>
+#include <cstring>
+
+static const unsigned char AUTO_MAGIC[4] = {'A', 'U', 'T', 'O'};
+
+AutoCompressor::AutoCompressor() : lastCodec(-1) {
+    // same settings the window uses for the codecs on their own
+    huffman.setBlockSize(1 << 20);
+    huffman.setFourStreams(true);
+    huffmanOrder1.setBlockSize(1 << 20);
+    huffmanOrder1.setContextModel(true);
+    rle.setPackBits(true);
+}
+
+void AutoCompressor::setRansCoding(bool enabled) {
+    huffman.setRansCoding(enabled);
+    lzHuffman.setRansCoding(enabled);
+    bwt.setRansCoding(enabled);
+}
+
+void AutoCompressor::setBlockSize(int bytes) {
+    huffman.setBlockSize(bytes);
+    huffmanOrder1.setBlockSize(bytes);
+    bwt.setBlockSize(bytes);
+}
+
+void AutoCompressor::setThreadCount(int threads) {
+    huffman.setThreadCount(threads);
+    huffmanOrder1.setThreadCount(threads);
+    bwt.setThreadCount(threads);
+}
+
+SampleStats AutoCompressor::analyze(const unsigned char* data, qint64 size) {
+    SampleStats stats;
+    if(size <= 0) return stats;
+
+    FrequencyTable freq;
+
+    // where the last 4 byte string with this hash started, checked for
+    // real before it counts as a repeat
+    const unsigned char* seen[1 << REPEAT_HASH_BITS];
+    for(int i = 0; i < (1 << REPEAT_HASH_BITS); i++) seen[i] = nullptr;
+
+    int runs = 0, repeats = 0, text = 0, total = 0, positions = 0;
+
+    // small inputs are looked at whole, big ones in evenly spaced pieces
+    int samples = SAMPLE_COUNT;
+    qint64 sampleSize = SAMPLE_SIZE;
+    if(size <= (qint64)SAMPLE_COUNT * SAMPLE_SIZE) {
+        samples = 1;
+        sampleSize = size;
+    }
+    qint64 step = (samples > 1) ? (size - sampleSize) / (samples - 1) : 0;
+
+    for(int s = 0; s < samples; s++) {
+        const unsigned char* p = data + s * step;
+        int n = (int)sampleSize;
+
+        freq.addBytes(p, n);
+        for(int i = 0; i < n; i++) {
+            unsigned char c = p[i];
+            if(i > 0 && c == p[i - 1]) runs++;
+            if((c >= 32 && c < 127) || c == '\n' || c == '\r' || c == '\t') text++;
+        }
+        total += n;
+
+        for(int i = 0; i + 4 <= n; i++) {
+            quint32 word;
+            memcpy(&word, p + i, 4);
+            unsigned int h = (word * 2654435761u) >> (32 - REPEAT_HASH_BITS);
+            if(seen[h] && memcmp(seen[h], p + i, 4) == 0) repeats++;
+            seen[h] = p + i;
+            positions++;
+        }
+    }
+
+    const unsigned long long* counts = freq.rawCounts();
+    double entropy = 0;
+    for(int c = 0; c < 256; c++) {
+        if(!counts[c]) continue;
+        double prob = (double)counts[c] / total;
+        entropy -= prob * std::log2(prob);
+    }
+
+    stats.entropy = entropy;
+    stats.runFraction = (double)runs / total;
+    stats.repeatFraction = positions ? (double)repeats / positions : 0;
+    stats.textFraction = (double)text / total;
+    stats.sampled = total;
+    return stats;
+}
+
+// long runs -> RLE, text with repeats -> BWT, other repeats -> LZ77 +
+// huffman, skewed bytes without repeats -> huffman, noise -> stored
+int AutoCompressor::chooseCodec(const SampleStats& stats) {
+    if(stats.sampled == 0) return STORED;
+    bool text = stats.textFraction > TEXT_MIN_FRACTION;
+    if(stats.runFraction > RLE_MIN_RUNS) return RLE;
+    if(text && stats.repeatFraction > BWT_MIN_REPEATS) return BWT;
+    if(stats.repeatFraction > LZ_MIN_REPEATS) return LZ_HUFFMAN;
+    if(stats.entropy < HUFFMAN_MAX_ENTROPY) return text ? HUFFMAN_ORDER1 : HUFFMAN;
+    return STORED;
+}
+
+const char* AutoCompressor::codecName(int codec) {
+    switch(codec) {
+    case STORED: return "Stored";
+    case HUFFMAN: return "Huffman";
+    case RLE: return "RLE";
+    case LZW: return "LZW";
+    case LZ77: return "LZ77";
+    case LZ_HUFFMAN: return "LZ77 + Huffman";
+    case BWT: return "BWT Block Sorting";
+    case HUFFMAN_ORDER1: return "Huffman (order-1 context)";
+    }
+    return "Unknown";
+}
+
+bool AutoCompressor::isAutoStream(const QByteArray& input) {
+    return input.size() >= HEADER_SIZE && memcmp(input.constData(), AUTO_MAGIC, 4) == 0;
+}
+
+QByteArray AutoCompressor::compressWith(int codec, const QByteArray& input) {
+    switch(codec) {
+    case STORED: return input;
+    case HUFFMAN: return huffman.compress(input);
+    case RLE: return rle.compress(input);
+    case LZW: return lzw.compress(input);
+    case LZ77: return lz77.compress(input);
+    case LZ_HUFFMAN: return lzHuffman.compress(input);
+    case BWT: return bwt.compress(input);
+    case HUFFMAN_ORDER1: return huffmanOrder1.compress(input);
+    }
+    return QByteArray();
+}
+
+QByteArray AutoCompressor::decompressWith(int codec, const QByteArray& input) {
+    switch(codec) {
+    case STORED: return input;
+    case HUFFMAN: return huffman.decompress(input);
+    case RLE: return rle.decompress(input);
+    case LZW: return lzw.decompress(input);
+    case LZ77: return lz77.decompress(input);
+    case LZ_HUFFMAN: return lzHuffman.decompress(input);
+    case BWT: return bwt.decompress(input);
+    case HUFFMAN_ORDER1: return huffmanOrder1.decompress(input);
+    }
+    return QByteArray();
+}
+
+QByteArray AutoCompressor::compress(const QByteArray& input) {
+    if(input.isEmpty()) return QByteArray();
+
+    SampleStats stats = analyze((const unsigned char*)input.constData(), input.size());
+    int codec = chooseCodec(stats);
+    QByteArray packed = compressWith(codec, input);
+
+    // a wrong guess still never makes the file much bigger
+    if(codec != STORED && (packed.isEmpty() || packed.size() >= input.size())) {
+        codec = STORED;
+        packed = input;
+    }
+    lastCodec = codec;
+
+    QByteArray result;
+    result.reserve(HEADER_SIZE + packed.size());
+    result.append((const char*)AUTO_MAGIC, 4);
+    result.append((char)codec);
+    result.append(packed);
+    return result;
+}
+
+QByteArray AutoCompressor::decompress(const QByteArray& input) {
+    if(!isAutoStream(input)) return QByteArray();
+
+    int codec = (unsigned char)input[4];
+    if(codec >= CODEC_COUNT) return QByteArray();   // from a newer version
+    lastCodec = codec;
+    return decompressWith(codec, input.mid(HEADER_SIZE));
+}
@@ -0,0 +1,95 @@
+#ifndef AUTOCOMPRESSOR_H
+#define AUTOCOMPRESSOR_H
+
+#include <QByteArray>
+#include "huffmancompressor.h"
+#include "rlecompressor.h"
+#include "lzwcompressor.h"
+#include "lz77compressor.h"
+#include "lzhuffmancompressor.h"
+#include "bwtcompressor.h"
+
+// What a quick look at the input found, all fractions are 0..1
+struct SampleStats {
+    double entropy;          // order 0 bits per byte
+    double runFraction;      // bytes equal to the byte before
+    double repeatFraction;   // positions where the next 4 bytes were seen before
+    double textFraction;     // printable ascii and whitespace
+    int sampled;             // bytes looked at
+
+    SampleStats() : entropy(0), runFraction(0), repeatFraction(0), textFraction(0), sampled(0) {}
+};
+
+// Auto mode: looks at a few KB from several places in the input, picks
+// the codec that fits and writes its id in front, so decompress() knows
+// what to run without being told
+// Layout: [magic 4][codec 1][output of that codec]
+class AutoCompressor {
+public:
+    // codec ids as stored in the header, never renumber these
+    static const int STORED = 0;
+    static const int HUFFMAN = 1;
+    static const int RLE = 2;
+    static const int LZW = 3;
+    static const int LZ77 = 4;
+    static const int LZ_HUFFMAN = 5;
+    static const int BWT = 6;
+    static const int HUFFMAN_ORDER1 = 7;
+    static const int CODEC_COUNT = 8;
+
+    // chooseCodec() cutoffs, found by running every codec on the sample
+    // files. A fraction has to be above its cutoff, entropy below
+    static constexpr double RLE_MIN_RUNS = 0.9;         // RLE ties the rest and is far faster
+    static constexpr double TEXT_MIN_FRACTION = 0.95;   // counts as text
+    static constexpr double BWT_MIN_REPEATS = 0.2;      // text repeating this much sorts well
+    static constexpr double LZ_MIN_REPEATS = 0.1;       // matches pay for LZ77 + huffman
+    static constexpr double HUFFMAN_MAX_ENTROPY = 7.5;  // bits per byte, above that stored wins
+
+private:
+    static const int SAMPLE_SIZE = 4096;     // bytes per sample
+    static const int SAMPLE_COUNT = 8;       // places sampled
+    static const int REPEAT_HASH_BITS = 12;  // 4 byte hash table for the repeat check
+    static const int HEADER_SIZE = 5;
+
+    HuffmanCompressor huffman;
+    HuffmanCompressor huffmanOrder1;
+    RLECompressor rle;
+    LZWCompressor lzw;
+    LZ77Compressor lz77;
+    LZHuffmanCompressor lzHuffman;
+    BWTCompressor bwt;
+
+    int lastCodec;   // what the last compress() or decompress() used
+
+public:
+    AutoCompressor();
+    ~AutoCompressor() {}
+
+    // entropy, runs and repeats of up to SAMPLE_COUNT x SAMPLE_SIZE bytes
+    // spread evenly over the data, takes microseconds for any input size
+    static SampleStats analyze(const unsigned char* data, qint64 size);
+    static int chooseCodec(const SampleStats& stats);
+    static const char* codecName(int codec);
+
+    // is this something compress() wrote
+    static bool isAutoStream(const QByteArray& input);
+
+    // forwarded to the codecs that have a rANS option
+    void setRansCoding(bool enabled);
+
+    // forwarded to the codecs that split their input into blocks
+    // (huffman and BWT), e.g. 1 thread when the caller runs several of us
+    void setBlockSize(int bytes);
+    void setThreadCount(int threads);
+
+    // run one codec by id, used by compress() and by the container
+    QByteArray compressWith(int codec, const QByteArray& input);
+    QByteArray decompressWith(int codec, const QByteArray& input);
+
+    int getLastCodec() const { return lastCodec; }
+
+    QByteArray compress(const QByteArray& input);
+    QByteArray decompress(const QByteArray& input);
+};
+
+#endif // AUTOCOMPRESSOR_H
@@ -0,0 +1,626 @@
+#include "bwtcompressor.h"
+#include "rlecompressor.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <cstring>
+
+BWTCompressor::BWTCompressor()
+    : blockSize(900 * 1024), threadCount(QThread::idealThreadCount()), ransCoding(false) {
+    if(threadCount < 1) threadCount = 1;
+}
+
+void BWTCompressor::setBlockSize(int bytes) {
+    if(bytes < MIN_BLOCK_SIZE) bytes = MIN_BLOCK_SIZE;
+    if(bytes > MAX_BLOCK_SIZE) bytes = MAX_BLOCK_SIZE;
+    blockSize = bytes;
+}
+
+void BWTCompressor::setThreadCount(int threads) {
+    if(threads < 1) threads = 1;
+    threadCount = threads;
+}
+
+static void appendInt32(QByteArray& output, int value) {
+    for(int i = 0; i < 4; i++) output.append((char)((value >> (i * 8)) & 0xFF));
+}
+
+static int readInt32(const unsigned char* src) {
+    int value = 0;
+    for(int i = 0; i < 4; i++) value |= (int)src[i] << (i * 8);
+    return value;
+}
+
+// ---- suffix array (SA-IS, Nong / Zhang / Chan) ----
+// s holds values 0..K and ends with a 0 that appears nowhere else
+
+// start (or end) of every character's bucket
+static void getBuckets(const int* s, int n, int K, int* bucket, bool end) {
+    for(int c = 0; c <= K; c++) bucket[c] = 0;
+    for(int i = 0; i < n; i++) bucket[s[i]]++;
+    int sum = 0;
+    for(int c = 0; c <= K; c++) {
+        sum += bucket[c];
+        bucket[c] = end ? sum : sum - bucket[c];
+    }
+}
+
+// L type suffixes follow from the sorted ones left to right,
+// S type ones right to left
+static void induceL(const unsigned char* type, int* SA, const int* s, int* bucket, int n, int K) {
+    getBuckets(s, n, K, bucket, false);
+    for(int i = 0; i < n; i++) {
+        int j = SA[i] - 1;
+        if(j >= 0 && !type[j]) SA[bucket[s[j]]++] = j;
+    }
+}
+
+static void induceS(const unsigned char* type, int* SA, const int* s, int* bucket, int n, int K) {
+    getBuckets(s, n, K, bucket, true);
+    for(int i = n - 1; i >= 0; i--) {
+        int j = SA[i] - 1;
+        if(j >= 0 && type[j]) SA[--bucket[s[j]]] = j;
+    }
+}
+
+static inline bool isLMS(const unsigned char* type, int i) {
+    return i > 0 && type[i] && !type[i - 1];
+}
+
+static void buildSuffixArray(const int* s, int* SA, int n, int K) {
+    // type 1 = S (smaller than the suffix after it), 0 = L
+    unsigned char* type = new unsigned char[n];
+    type[n - 1] = 1;
+    for(int i = n - 2; i >= 0; i--) {
+        type[i] = (s[i] < s[i + 1] || (s[i] == s[i + 1] && type[i + 1])) ? 1 : 0;
+    }
+
+    int* bucket = new int[K + 1];
+
+    // sort the LMS substrings by dropping them at their bucket ends and inducing
+    getBuckets(s, n, K, bucket, true);
+    for(int i = 0; i < n; i++) SA[i] = -1;
+    for(int i = 1; i < n; i++) {
+        if(isLMS(type, i)) SA[--bucket[s[i]]] = i;
+    }
+    induceL(type, SA, s, bucket, n, K);
+    induceS(type, SA, s, bucket, n, K);
+
+    // pack the sorted LMS positions into the front
+    int n1 = 0;
+    for(int i = 0; i < n; i++) {
+        if(isLMS(type, SA[i])) SA[n1++] = SA[i];
+    }
+
+    // name them, equal substrings get the same name
+    for(int i = n1; i < n; i++) SA[i] = -1;
+    int name = 0;
+    int prev = -1;
+    for(int i = 0; i < n1; i++) {
+        int pos = SA[i];
+        bool diff = false;
+        for(int d = 0; d < n; d++) {
+            if(prev == -1 || s[pos + d] != s[prev + d] || type[pos + d] != type[prev + d]) {
+                diff = true;
+                break;
+            }
+            if(d > 0 && (isLMS(type, pos + d) || isLMS(type, prev + d))) break;
+        }
+        if(diff) {
+            name++;
+            prev = pos;
+        }
+        // no two LMS positions are neighbours, so pos / 2 is a free slot
+        SA[n1 + pos / 2] = name - 1;
+    }
+    for(int i = n - 1, j = n - 1; i >= n1; i--) {
+        if(SA[i] >= 0) SA[j--] = SA[i];
+    }
+
+    // order of the LMS suffixes: directly if every name is unique,
+    // otherwise from the suffix array of the reduced string
+    int* s1 = SA + n - n1;
+    if(name < n1) {
+        buildSuffixArray(s1, SA, n1, name - 1);
+    } else {
+        for(int i = 0; i < n1; i++) SA[s1[i]] = i;
+    }
+
+    // put the LMS suffixes in that order at their bucket ends and induce the rest
+    getBuckets(s, n, K, bucket, true);
+    for(int i = 1, j = 0; i < n; i++) {
+        if(isLMS(type, i)) s1[j++] = i;
+    }
+    for(int i = 0; i < n1; i++) SA[i] = s1[SA[i]];
+    for(int i = n1; i < n; i++) SA[i] = -1;
+    for(int i = n1 - 1; i >= 0; i--) {
+        int j = SA[i];
+        SA[i] = -1;
+        SA[--bucket[s[j]]] = j;
+    }
+    induceL(type, SA, s, bucket, n, K);
+    induceS(type, SA, s, bucket, n, K);
+
+    delete[] bucket;
+    delete[] type;
+}
+
+// ---- move to front ----
+
+static void moveToFront(unsigned char* data, int size) {
+    unsigned char order[256];
+    for(int c = 0; c < 256; c++) order[c] = (unsigned char)c;
+
+    for(int i = 0; i < size; i++) {
+        unsigned char c = data[i];
+        int j = 0;
+        while(order[j] != c) j++;
+        memmove(order + 1, order, j);
+        order[0] = c;
+        data[i] = (unsigned char)j;
+    }
+}
+
+static void undoMoveToFront(unsigned char* data, int size) {
+    unsigned char order[256];
+    for(int c = 0; c < 256; c++) order[c] = (unsigned char)c;
+
+    for(int i = 0; i < size; i++) {
+        int j = data[i];
+        unsigned char c = order[j];
+        memmove(order + 1, order, j);
+        order[0] = c;
+        data[i] = c;
+    }
+}
+
+// ---- blocks ----
+
+// more tables pay off once there are enough symbols to fill them (bzip2's steps)
+int BWTCompressor::tableCount(int symbols) {
+    if(symbols < 200) return 2;
+    if(symbols < 600) return 3;
+    if(symbols < 1200) return 4;
+    if(symbols < 2400) return 5;
+    return MAX_TABLES;
+}
+
+// table choices change slowly, so move-to-front keeps them short
+void BWTCompressor::writeSelectors(BitWriter& writer, const unsigned char* selectors, int groups) {
+    unsigned char order[MAX_TABLES];
+    for(int t = 0; t < MAX_TABLES; t++) order[t] = (unsigned char)t;
+    for(int g = 0; g < groups; g++) {
+        int j = 0;
+        while(order[j] != selectors[g]) j++;
+        memmove(order + 1, order, j);
+        order[0] = selectors[g];
+        writer.write(((1u << j) - 1) << 1, j + 1);  // j ones then a zero
+    }
+}
+
+bool BWTCompressor::readSelectors(BitReader& reader, unsigned char* selectors, int groups, int tables) {
+    unsigned char order[MAX_TABLES];
+    for(int t = 0; t < MAX_TABLES; t++) order[t] = (unsigned char)t;
+    for(int g = 0; g < groups; g++) {
+        int j = 0;
+        while(reader.read(1)) {
+            if(++j >= tables) return false;
+        }
+        unsigned char t = order[j];
+        memmove(order + 1, order, j);
+        order[0] = t;
+        selectors[g] = t;
+    }
+    return true;
+}
+
+// Block layout:
+//   4 bytes          block size
+//   4 bytes          primary index (row of the whole block in the sorted rotations)
+//   4 bytes          symbol count after the zero run stage
+//   1 byte           table count
+//   code tables      one per table
+//   bits             table choice per group (move-to-front, unary),
+//                    then the symbols of every group with its table
+// with rANS the tables are rANS tables and the rest is
+//   4 bytes          size of the table choices, then the choices as above
+//   rANS data        the symbols of every group with its table
+bool BWTCompressor::compressBlock(const unsigned char* src, int size, QByteArray& output, bool rans) {
+    // sort the rotations through the suffix array of block + sentinel
+    int* text = new int[size + 1];
+    for(int i = 0; i < size; i++) text[i] = src[i] + 1;
+    text[size] = 0;
+    int* SA = new int[size + 1];
+    buildSuffixArray(text, SA, size + 1, 256);
+    delete[] text;
+
+    // last column, the sentinel's own row is left out and remembered
+    QByteArray last(size, 0);
+    unsigned char* lastCol = (unsigned char*)last.data();
+    int primary = 0;
+    for(int i = 0, k = 0; i <= size; i++) {
+        if(SA[i] == 0) primary = i;
+        else lastCol[k++] = src[SA[i] - 1];
+    }
+    delete[] SA;
+
+    moveToFront(lastCol, size);
+    QByteArray symbols = RLECompressor::encodeZeroRuns(last);
+    last = QByteArray();
+
+    const unsigned char* sym = (const unsigned char*)symbols.constData();
+    int symbolCount = symbols.size();
+    int groups = (symbolCount + GROUP_SIZE - 1) / GROUP_SIZE;
+    int tables = tableCount(symbolCount);
+
+    FrequencyTable freq;
+    freq.addBytes(sym, symbolCount);
+    const unsigned long long* used = freq.rawCounts();
+
+    // starting guess: split the alphabet into ranges of about equal
+    // frequency, each table is cheap inside its range only
+    unsigned char lengths[MAX_TABLES][256];
+    int lo = 0;
+    qint64 remaining = symbolCount;
+    for(int t = 0; t < tables; t++) {
+        qint64 target = remaining / (tables - t);
+        qint64 sum = 0;
+        int hi = lo;
+        while(hi < 256 && (sum < target || t == tables - 1)) sum += used[hi++];
+        for(int c = 0; c < 256; c++) lengths[t][c] = (c >= lo && c < hi) ? 0 : CODE_LENGTH;
+        remaining -= sum;
+        lo = hi;
+    }
+
+    unsigned char* selectors = new unsigned char[groups];
+    HuffmanCompressor coders[MAX_TABLES];
+
+    // every group takes its cheapest table, then the tables are rebuilt
+    // from the groups that picked them
+    unsigned long long counts[MAX_TABLES][256];
+    for(int pass = 0; pass < TABLE_PASSES; pass++) {
+        memset(counts, 0, sizeof(counts));
+
+        for(int g = 0; g < groups; g++) {
+            int first = g * GROUP_SIZE;
+            int end = first + GROUP_SIZE < symbolCount ? first + GROUP_SIZE : symbolCount;
+
+            int cost[MAX_TABLES] = {0};
+            for(int i = first; i < end; i++) {
+                for(int t = 0; t < tables; t++) cost[t] += lengths[t][sym[i]];
+            }
+            int best = 0;
+            for(int t = 1; t < tables; t++) {
+                if(cost[t] < cost[best]) best = t;
+            }
+            selectors[g] = (unsigned char)best;
+            for(int i = first; i < end; i++) counts[best][sym[i]]++;
+        }
+
+        // every table can code every symbol of the block
+        for(int t = 0; t < tables; t++) {
+            for(int c = 0; c < 256; c++) {
+                if(used[c]) counts[t][c]++;
+            }
+            coders[t].setMaxCodeLength(CODE_LENGTH);
+            coders[t].buildCodesFromCounts(counts[t]);
+            for(int c = 0; c < 256; c++) lengths[t][c] = (unsigned char)coders[t].symbolLength(c);
+        }
+    }
+
+    appendInt32(output, size);
+    appendInt32(output, primary);
+    appendInt32(output, symbolCount);
+    output.append((char)tables);
+
+    if(rans) {
+        // same groups and counts, coded with rANS tables instead
+        RANSCoder models[MAX_TABLES];
+        for(int t = 0; t < tables; t++) {
+            models[t].buildFromCounts(counts[t]);
+            models[t].writeTable(output);
+        }
+
+        QByteArray selectorBits((groups * MAX_TABLES + 7) / 8 + 8, 0);
+        BitWriter writer((unsigned char*)selectorBits.data());
+        writeSelectors(writer, selectors, groups);
+        writer.flush();
+        int selectorSize = (int)writer.bytesWritten();
+        appendInt32(output, selectorSize);
+        output.append(QByteArray::fromRawData(selectorBits.constData(), selectorSize));
+
+        RANSEncoder encoder(symbolCount);
+        for(int i = symbolCount - 1; i >= 0; i--) {
+            encoder.put(models[selectors[i / GROUP_SIZE]], sym[i], i & (RANSCoder::LANES - 1));
+        }
+        encoder.finish(output);
+        delete[] selectors;
+        return true;
+    }
+
+    for(int t = 0; t < tables; t++) coders[t].writeCodeTable(output);
+
+    qint64 maxBytes = ((qint64)groups * MAX_TABLES + (qint64)symbolCount * CODE_LENGTH + 7) / 8;
+    if(output.size() + maxBytes + 8 > 0x7FFFFFFF) {
+        delete[] selectors;
+        return false;
+    }
+    int dataStart = output.size();
+    output.resize(dataStart + (int)maxBytes + 8);
+
+    BitWriter writer((unsigned char*)output.data() + dataStart);
+    writeSelectors(writer, selectors, groups);
+
+    for(int g = 0; g < groups; g++) {
+        const HuffmanCompressor& coder = coders[selectors[g]];
+        int first = g * GROUP_SIZE;
+        int end = first + GROUP_SIZE < symbolCount ? first + GROUP_SIZE : symbolCount;
+        for(int i = first; i < end; i++) coder.writeSymbol(writer, sym[i]);
+    }
+    writer.flush();
+
+    output.resize(dataStart + (int)writer.bytesWritten());
+    delete[] selectors;
+    return true;
+}
+
+bool BWTCompressor::decompressBlock(const unsigned char* src, int size, unsigned char* dst, int dstSize,
+                                    bool rans) {
+    if(size < 13) return false;
+    int blockLength = readInt32(src);
+    int primary = readInt32(src + 4);
+    int symbolCount = readInt32(src + 8);
+    int tables = src[12];
+
+    // the zero run stage never more than doubles the block
+    if(blockLength != dstSize || primary < 1 || primary > blockLength) return false;
+    if(symbolCount < 1 || symbolCount > 2 * blockLength) return false;
+    if(tables < 2 || tables > MAX_TABLES) return false;
+
+    QByteArray block = QByteArray::fromRawData((const char*)src, size);
+    int pos = 13;
+    HuffmanCompressor coders[MAX_TABLES];
+    RANSCoder models[MAX_TABLES];
+    for(int t = 0; t < tables; t++) {
+        coders[t].setMaxCodeLength(CODE_LENGTH);
+        bool loaded = rans ? models[t].readTable(block, pos) : coders[t].readCodeTable(block, pos);
+        if(!loaded) return false;
+    }
+
+    int groups = (symbolCount + GROUP_SIZE - 1) / GROUP_SIZE;
+    unsigned char* selectors = new unsigned char[groups];
+    QByteArray symbols;
+    symbols.resize(symbolCount);
+    unsigned char* sym = (unsigned char*)symbols.data();
+    bool ok = true;
+
+    if(rans) {
+        int selectorSize = size - pos >= 4 ? readInt32(src + pos) : -1;
+        pos += 4;
+        ok = selectorSize >= 0 && selectorSize <= size - pos;
+        if(ok) {
+            BitReader reader(src + pos, selectorSize);
+            ok = readSelectors(reader, selectors, groups, tables) &&
+                 reader.position() <= (qint64)selectorSize * 8;
+            pos += selectorSize;
+        }
+        if(ok) {
+            RANSDecoder decoder(src + pos, size - pos);
+            for(int i = 0; i < symbolCount; i++) {
+                sym[i] = (unsigned char)decoder.get(models[selectors[i / GROUP_SIZE]], i & (RANSCoder::LANES - 1));
+            }
+            ok = decoder.finished();
+        }
+    } else {
+        // every symbol takes at least one bit
+        ok = (qint64)symbolCount <= (qint64)(size - pos) * 8;
+
+        BitReader reader(src + pos, size - pos);
+        if(ok) ok = readSelectors(reader, selectors, groups, tables);
+        for(int g = 0; g < groups && ok; g++) {
+            const HuffmanCompressor& coder = coders[selectors[g]];
+            int first = g * GROUP_SIZE;
+            int end = first + GROUP_SIZE < symbolCount ? first + GROUP_SIZE : symbolCount;
+            for(int i = first; i < end; i++) {
+                int s = coder.readSymbol(reader);
+                if(s < 0) {
+                    ok = false;
+                    break;
+                }
+                sym[i] = (unsigned char)s;
+            }
+        }
+        if(ok) ok = reader.position() <= (qint64)(size - pos) * 8;
+    }
+    delete[] selectors;
+    if(!ok) return false;
+
+    QByteArray last = RLECompressor::decodeZeroRuns(symbols, blockLength);
+    if(last.size() != blockLength) return false;
+    unsigned char* lastCol = (unsigned char*)last.data();
+    undoMoveToFront(lastCol, blockLength);
+
+    // rows of the sorted rotations, row 0 is the sentinel's. each row
+    // links to the row one step back in the text (LF mapping), packed
+    // with its last character as (row << 8) | char
+    int start[256];
+    int count[256];
+    memset(count, 0, sizeof(count));
+    for(int i = 0; i < blockLength; i++) count[lastCol[i]]++;
+    int sum = 1;
+    for(int c = 0; c < 256; c++) {
+        start[c] = sum;
+        sum += count[c];
+    }
+
+    unsigned int* links = new unsigned int[blockLength + 1];
+    links[primary] = 0;
+    for(int i = 0, k = 0; i <= blockLength; i++) {
+        if(i == primary) continue;
+        unsigned char c = lastCol[k++];
+        links[i] = ((unsigned int)start[c]++ << 8) | c;
+    }
+
+    // row 0 ends with the last character, walk backwards from there
+    unsigned int row = 0;
+    for(int k = blockLength - 1; k >= 0; k--) {
+        unsigned int link = links[row];
+        dst[k] = (unsigned char)(link & 0xFF);
+        row = link >> 8;
+    }
+    delete[] links;
+
+    // and the walk has to end on the row of the whole block
+    return row == (unsigned int)primary;
+}
+
+// every block is sorted and coded on its own, so they run side by side
+class BWTBlockTask : public QRunnable {
+public:
+    const unsigned char* src;
+    int srcSize;
+    QByteArray* packed;   // compress: where the block goes
+    unsigned char* dst;   // decompress: slice of the output
+    int dstSize;
+    bool decode;
+    bool rans;
+    bool* ok;
+
+    void run() override {
+        if(!decode) *ok = BWTCompressor::compressBlock(src, srcSize, *packed, rans);
+        else *ok = BWTCompressor::decompressBlock(src, srcSize, dst, dstSize, rans);
+    }
+};
+
+// Layout:
+//   8 bytes              original size
+//   4 bytes              block size
+//   4 bytes              block count
+//   4 bytes per block    compressed size of each block
+//   blocks               see compressBlock
+// with rANS the same behind a marker:
+//   FF FF FF FF          marker, no original size starts like this
+//   1 byte               flags (STREAM_RANS)
+QByteArray BWTCompressor::compress(const QByteArray& input) {
+    if(input.isEmpty()) return QByteArray();
+
+    int blockCount = (int)(((qint64)input.size() + blockSize - 1) / blockSize);
+    QByteArray* packed = new QByteArray[blockCount];
+    bool* ok = new bool[blockCount];
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+
+    const unsigned char* src = (const unsigned char*)input.constData();
+    for(int b = 0; b < blockCount; b++) {
+        BWTBlockTask* task = new BWTBlockTask();
+        task->src = src + (qint64)b * blockSize;
+        task->srcSize = (b == blockCount - 1) ? input.size() - b * blockSize : blockSize;
+        task->packed = &packed[b];
+        task->dst = nullptr;
+        task->dstSize = 0;
+        task->decode = false;
+        task->rans = ransCoding;
+        task->ok = &ok[b];
+        pool.start(task);
+    }
+    pool.waitForDone();
+
+    QByteArray result;
+    qint64 total = 0;
+    bool allOk = true;
+    for(int b = 0; b < blockCount; b++) {
+        if(!ok[b]) allOk = false;
+        total += packed[b].size();
+    }
+
+    if(allOk && total + 21 + 4LL * blockCount <= 0x7FFFFFFF) {
+        result.reserve((int)(total + 21 + 4LL * blockCount));
+
+        if(ransCoding) {
+            for(int i = 0; i < 4; i++) result.append((char)0xFF);
+            result.append((char)STREAM_RANS);
+        }
+        qint64 origSize = input.size();
+        for(int i = 0; i < 8; i++) result.append((char)((origSize >> (i * 8)) & 0xFF));
+        appendInt32(result, blockSize);
+        appendInt32(result, blockCount);
+        for(int b = 0; b < blockCount; b++) appendInt32(result, packed[b].size());
+        for(int b = 0; b < blockCount; b++) result.append(packed[b]);
+    }
+
+    delete[] packed;
+    delete[] ok;
+    return result;
+}
+
+QByteArray BWTCompressor::decompress(const QByteArray& input) {
+    const unsigned char* data = (const unsigned char*)input.constData();
+
+    bool rans = false;
+    int pos = 0;
+    if(input.size() >= 5 && data[0] == 0xFF && data[1] == 0xFF && data[2] == 0xFF && data[3] == 0xFF) {
+        if(data[4] & ~STREAM_RANS) return QByteArray();  // from a newer version
+        rans = (data[4] & STREAM_RANS) != 0;
+        pos = 5;
+    }
+    if(input.size() - pos < 16) return QByteArray();
+
+    qint64 origSize = 0;
+    for(int i = 0; i < 8; i++) origSize |= (qint64)data[pos + i] << (i * 8);
+    int size = readInt32(data + pos + 8);
+    int count = readInt32(data + pos + 12);
+    pos += 16;
+
+    if(origSize <= 0 || origSize > 0x7FFFFFFF) return QByteArray();
+    if(size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE || count <= 0) return QByteArray();
+    if((origSize + size - 1) / size != count) return QByteArray();
+    if((qint64)count * 4 > input.size() - pos) return QByteArray();
+
+    // compressed blocks have to add up to the rest of the file
+    int tableStart = pos;
+    qint64 total = 0;
+    for(int b = 0; b < count; b++) {
+        int packedSize = readInt32(data + pos);
+        pos += 4;
+        if(packedSize <= 0) return QByteArray();
+        total += packedSize;
+    }
+    if(pos + total != input.size()) return QByteArray();
+
+    QByteArray result;
+    result.resize((int)origSize);
+
+    bool* ok = new bool[count];
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+
+    int blockPos = pos;
+    for(int b = 0; b < count; b++) {
+        int packedSize = readInt32(data + tableStart + b * 4);
+
+        BWTBlockTask* task = new BWTBlockTask();
+        task->src = data + blockPos;
+        task->srcSize = packedSize;
+        task->packed = nullptr;
+        task->dst = (unsigned char*)result.data() + (qint64)b * size;
+        task->dstSize = (b == count - 1) ? (int)(origSize - (qint64)b * size) : size;
+        task->decode = true;
+        task->rans = rans;
+        task->ok = &ok[b];
+        pool.start(task);
+
+        blockPos += packedSize;
+    }
+    pool.waitForDone();
+
+    bool allOk = true;
+    for(int b = 0; b < count; b++) {
+        if(!ok[b]) allOk = false;
+    }
+    delete[] ok;
+
+    if(!allOk) return QByteArray();
+    return result;
+}
@@ -0,0 +1,53 @@
+#ifndef BWTCOMPRESSOR_H
+#define BWTCOMPRESSOR_H
+
+#include <QByteArray>
+#include "datastructures.h"
+#include "huffmancompressor.h"
+#include "ranscoder.h"
+
+// bzip2 style pipeline, one block at a time: burrows-wheeler transform
+// (suffix array built with SA-IS), move-to-front, zero runs from
+// RLECompressor, then huffman with several tables switched every 50 symbols
+class BWTCompressor {
+    friend class BWTBlockTask;
+
+private:
+    static const int MIN_BLOCK_SIZE = 1 << 16;
+    static const int MAX_BLOCK_SIZE = 1 << 23;   // row numbers have to fit in 24 bits
+    static const int GROUP_SIZE = 50;            // symbols per table choice
+    static const int MAX_TABLES = 6;
+    static const int TABLE_PASSES = 4;           // rounds of refining the tables
+    static const int CODE_LENGTH = 15;           // code length cap for all tables
+    static const unsigned char STREAM_RANS = 1;  // layout flag
+
+    int blockSize;
+    int threadCount;
+    bool ransCoding;   // rANS tables instead of huffman codes
+
+    static int tableCount(int symbols);
+    static void writeSelectors(BitWriter& writer, const unsigned char* selectors, int groups);
+    static bool readSelectors(BitReader& reader, unsigned char* selectors, int groups, int tables);
+    static bool compressBlock(const unsigned char* src, int size, QByteArray& output, bool rans);
+    static bool decompressBlock(const unsigned char* src, int size, unsigned char* dst, int dstSize,
+                                bool rans);
+
+public:
+    BWTCompressor();
+    ~BWTCompressor() {}
+
+    // bigger blocks find more context and compress better, but every
+    // block needs about 9x its size in memory while it's sorted
+    void setBlockSize(int bytes);
+    int getBlockSize() const { return blockSize; }
+    void setThreadCount(int threads);
+
+    // rANS for the symbol tables, decompress() reads both
+    void setRansCoding(bool enabled) { ransCoding = enabled; }
+    bool getRansCoding() const { return ransCoding; }
+
+    QByteArray compress(const QByteArray& input);
+    QByteArray decompress(const QByteArray& input);
+};
+
+#endif // BWTCOMPRESSOR_H
@@ -0,0 +1,676 @@
+#include "containercompressor.h"
+#include <QBuffer>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QtEndian>
+#include <cstring>
+
+static const unsigned char HEADER_MAGIC[4] = {'C', 'S', 'P', 'F'};
+static const unsigned char FOOTER_MAGIC[4] = {'C', 'S', 'P', 'E'};
+
+void ContainerIndex::allocate(int blocks) {
+    clear();
+    count = blocks;
+    offsets = new qint64[blocks + 1];
+    starts = new qint64[blocks + 1];
+    sizes = new int[blocks + 1];
+}
+
+void ContainerIndex::clear() {
+    delete[] offsets;
+    delete[] starts;
+    delete[] sizes;
+    offsets = nullptr;
+    starts = nullptr;
+    sizes = nullptr;
+    count = 0;
+    originalSize = 0;
+}
+
+int ContainerIndex::findBlock(qint64 pos) const {
+    if(pos < 0 || pos >= originalSize) return -1;
+
+    // binary search over the block starts
+    int lo = 0, hi = count - 1;
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if(starts[mid] <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// bytes in block b, only the last one is short
+static int blockBytes(qint64 inputSize, int blockSize, int b) {
+    qint64 left = inputSize - (qint64)b * blockSize;
+    return (int)(left < blockSize ? left : blockSize);
+}
+
+// check and decode one block, block points at its header and has
+// blockBytes bytes up to the next block
+static bool decodeBlock(AutoCompressor& codecs, const unsigned char* block, qint64 blockBytes,
+                        int originalSize, char* out, int& codec) {
+    if(blockBytes < ContainerCompressor::BLOCK_HEADER_SIZE) return false;
+    codec = block[0];
+    int size = (int)qFromLittleEndian<quint32>(block + 1);
+    qint64 packedSize = qFromLittleEndian<quint32>(block + 5);
+    quint32 crc = qFromLittleEndian<quint32>(block + 9);
+    if(codec >= AutoCompressor::CODEC_COUNT) return false;
+    if(size != originalSize || packedSize != blockBytes - ContainerCompressor::BLOCK_HEADER_SIZE) return false;
+
+    const unsigned char* data = block + ContainerCompressor::BLOCK_HEADER_SIZE;
+    if(codec == AutoCompressor::STORED) {
+        if(packedSize != size) return false;
+        memcpy(out, data, (size_t)size);
+    } else {
+        QByteArray decoded = codecs.decompressWith(codec,
+                                                   QByteArray::fromRawData((const char*)data, (int)packedSize));
+        if(decoded.size() != size) return false;
+        memcpy(out, decoded.constData(), (size_t)size);
+    }
+
+    return CRC32::update(0, (const unsigned char*)out, size) == crc;
+}
+
+// codes every stride-th block from first on, each task gets its own
+// worker's codecs so nothing is shared between threads
+class ContainerTask : public QRunnable {
+public:
+    AutoCompressor* codecs;
+    int first;
+    int stride;
+    int blockCount;
+    bool decode;
+    bool* ok;
+
+    // compress
+    const unsigned char* input;
+    qint64 inputSize;
+    int blockSize;
+    int codec;
+    QByteArray* packed;
+    unsigned char* chosen;
+    quint32* crcs;
+
+    // decompress
+    const unsigned char* file;
+    const ContainerIndex* index;
+    char* out;
+
+    void run() override {
+        for(int b = first; b < blockCount; b += stride) {
+            if(decode) decodeOne(b);
+            else encodeOne(b);
+        }
+    }
+
+    void encodeOne(int b) {
+        const unsigned char* src = input + (qint64)b * blockSize;
+        int size = blockBytes(inputSize, blockSize, b);
+        crcs[b] = CRC32::update(0, src, size);
+
+        int use = codec;
+        if(use == ContainerCompressor::AUTO) {
+            use = AutoCompressor::chooseCodec(AutoCompressor::analyze(src, size));
+        }
+        if(use != AutoCompressor::STORED) {
+            packed[b] = codecs->compressWith(use, QByteArray::fromRawData((const char*)src, size));
+
+            // stored when the codec didn't help, the data is copied from input later
+            if(packed[b].isEmpty() || packed[b].size() >= size) {
+                packed[b] = QByteArray();
+                use = AutoCompressor::STORED;
+            }
+        }
+        chosen[b] = (unsigned char)use;
+        ok[b] = true;
+    }
+
+    void decodeOne(int b) {
+        int used = 0;
+        ok[b] = decodeBlock(*codecs, file + index->offsets[b], index->offsets[b + 1] - index->offsets[b],
+                            index->sizes[b], out + index->starts[b], used);
+        chosen[b] = (unsigned char)used;
+    }
+};
+
+ContainerCompressor::ContainerCompressor()
+    : blockSize(1 << 20), threadCount(QThread::idealThreadCount()), ransCoding(false),
+      workers(nullptr), workerCount(0) {
+    if(threadCount < 1) threadCount = 1;
+    for(int c = 0; c < AutoCompressor::CODEC_COUNT; c++) blockCodecs[c] = 0;
+}
+
+ContainerCompressor::~ContainerCompressor() {
+    delete[] workers;
+}
+
+// codecs for tasks workers, only made again when more threads are asked for
+AutoCompressor* ContainerCompressor::prepareWorkers(int tasks) {
+    if(workerCount < tasks) {
+        delete[] workers;
+        workers = new AutoCompressor[tasks];
+        workerCount = tasks;
+    }
+    for(int t = 0; t < tasks; t++) {
+        workers[t].setBlockSize(blockSize);
+        workers[t].setThreadCount(1);
+        workers[t].setRansCoding(ransCoding);
+    }
+    return workers;
+}
+
+void ContainerCompressor::setBlockSize(int bytes) {
+    if(bytes < MIN_BLOCK_SIZE) bytes = MIN_BLOCK_SIZE;
+    if(bytes > MAX_BLOCK_SIZE) bytes = MAX_BLOCK_SIZE;
+    blockSize = bytes;
+}
+
+void ContainerCompressor::setThreadCount(int threads) {
+    if(threads < 1) threads = 1;
+    threadCount = threads;
+}
+
+bool ContainerCompressor::isContainer(const QByteArray& input) {
+    return input.size() >= HEADER_SIZE + FOOTER_SIZE && memcmp(input.constData(), HEADER_MAGIC, 4) == 0;
+}
+
+bool ContainerCompressor::checkHeader(const unsigned char* header) {
+    if(memcmp(header, HEADER_MAGIC, 4) != 0) return false;
+    // other versions lay the index out differently
+    return header[4] == VERSION && (header[6] & ~FLAG_RANS) == 0;
+}
+
+int ContainerCompressor::containerCodec(const QByteArray& input) {
+    if(!isContainer(input)) return -1;
+    return (unsigned char)input[5];
+}
+
+bool ContainerCompressor::readIndex(const unsigned char* tail, qint64 tailSize, qint64 fileSize,
+                                    ContainerIndex& index, qint64& needed) {
+    index.clear();
+    needed = 0;
+    if(fileSize < HEADER_SIZE + FOOTER_SIZE) return false;
+    if(tailSize < FOOTER_SIZE) {
+        needed = FOOTER_SIZE;
+        return false;
+    }
+
+    const unsigned char* footer = tail + tailSize - FOOTER_SIZE;
+    if(memcmp(footer + 24, FOOTER_MAGIC, 4) != 0) return false;
+    qint64 indexOffset = (qint64)qFromLittleEndian<quint64>(footer);
+    qint64 count = qFromLittleEndian<quint32>(footer + 8);
+    qint64 originalSize = (qint64)qFromLittleEndian<quint64>(footer + 12);
+    quint32 crc = qFromLittleEndian<quint32>(footer + 20);
+
+    // the index has to sit right in front of the footer
+    if(indexOffset < HEADER_SIZE || count > (fileSize - HEADER_SIZE) / BLOCK_HEADER_SIZE) return false;
+    if(indexOffset + 1 + count * INDEX_ENTRY_SIZE + FOOTER_SIZE != fileSize) return false;
+    if(originalSize < 0) return false;
+
+    needed = fileSize - indexOffset;
+    if(tailSize < needed) return false;
+
+    const unsigned char* marker = tail + tailSize - needed;
+    if(CRC32::update(0, marker, needed - 8) != crc || marker[0] != END_OF_BLOCKS) return false;
+    const unsigned char* entries = marker + 1;
+
+    index.allocate((int)count);
+    qint64 start = 0;
+    qint64 expected = HEADER_SIZE;
+    int b = 0;
+    for(; b < count; b++) {
+        const unsigned char* e = entries + (qint64)b * INDEX_ENTRY_SIZE;
+        qint64 offset = (qint64)qFromLittleEndian<quint64>(e);
+        qint64 size = qFromLittleEndian<quint32>(e + 8);
+
+        // blocks follow each other in order and fit before the index
+        if(b == 0 && offset != expected) break;
+        if(offset < expected || offset + BLOCK_HEADER_SIZE > indexOffset) break;
+        if(size < 1 || size > MAX_BLOCK_SIZE) break;
+
+        index.offsets[b] = offset;
+        index.starts[b] = start;
+        index.sizes[b] = (int)size;
+        start += size;
+        expected = offset + BLOCK_HEADER_SIZE;
+    }
+
+    // a broken entry stops the loop early
+    if(b < count || start != originalSize) {
+        index.clear();
+        needed = 0;
+        return false;
+    }
+
+    // one past the last block, so block b always ends at offsets[b + 1]
+    index.offsets[count] = indexOffset;
+    index.starts[count] = start;
+    index.sizes[count] = 0;
+    index.originalSize = originalSize;
+    return true;
+}
+
+// reads until size bytes came in or the input ended, -1 on errors
+static qint64 readUpTo(QIODevice* in, char* dst, qint64 size) {
+    qint64 total = 0;
+    while(total < size) {
+        qint64 got = in->read(dst + total, size - total);
+        if(got < 0) return -1;
+        if(got == 0) break;
+        total += got;
+    }
+    return total;
+}
+
+static bool readFully(QIODevice* in, char* dst, qint64 size) {
+    return readUpTo(in, dst, size) == size;
+}
+
+static bool writeFully(QIODevice* out, const char* src, qint64 size) {
+    while(size > 0) {
+        qint64 put = out->write(src, size);
+        if(put <= 0) return false;
+        src += put;
+        size -= put;
+    }
+    return true;
+}
+
+// blocks coded side by side, enough to keep every thread busy without
+// holding more than STREAM_BATCH bytes of input at once
+int ContainerCompressor::batchBlocks(int bytesPerBlock) const {
+    int blocks = STREAM_BATCH / bytesPerBlock;
+    if(blocks > threadCount) blocks = threadCount;
+    if(blocks < 1) blocks = 1;
+    return blocks;
+}
+
+void ContainerCompressor::encodeBlocks(const unsigned char* data, qint64 size, int codec,
+                                       QByteArray* packed, unsigned char* chosen, quint32* crcs, bool* ok) {
+    int blockCount = (int)((size + blockSize - 1) / blockSize);
+
+    // one task per thread, each with its own codecs working single threaded
+    int tasks = (blockCount < threadCount) ? blockCount : threadCount;
+    if(tasks < 1) tasks = 1;
+    AutoCompressor* codecs = prepareWorkers(tasks);
+    QThreadPool pool;
+    pool.setMaxThreadCount(tasks);
+    for(int t = 0; t < tasks; t++) {
+        ContainerTask* task = new ContainerTask();
+        task->codecs = &codecs[t];
+        task->first = t;
+        task->stride = tasks;
+        task->blockCount = blockCount;
+        task->decode = false;
+        task->ok = ok;
+        task->input = data;
+        task->inputSize = size;
+        task->blockSize = blockSize;
+        task->codec = codec;
+        task->packed = packed;
+        task->chosen = chosen;
+        task->crcs = crcs;
+        pool.start(task);
+    }
+    pool.waitForDone();
+}
+
+bool ContainerCompressor::decodeBlocks(const unsigned char* file, const ContainerIndex& index, char* out) {
+    unsigned char* chosen = new unsigned char[index.count + 1];
+    bool* ok = new bool[index.count + 1];
+
+    int tasks = (index.count < threadCount) ? index.count : threadCount;
+    if(tasks < 1) tasks = 1;
+    AutoCompressor* codecs = prepareWorkers(tasks);
+    QThreadPool pool;
+    pool.setMaxThreadCount(tasks);
+    for(int t = 0; t < tasks; t++) {
+        ContainerTask* task = new ContainerTask();
+        task->codecs = &codecs[t];
+        task->first = t;
+        task->stride = tasks;
+        task->blockCount = index.count;
+        task->decode = true;
+        task->ok = ok;
+        task->chosen = chosen;
+        task->file = file;
+        task->index = &index;
+        task->out = out;
+        pool.start(task);
+    }
+    pool.waitForDone();
+
+    bool allOk = true;
+    for(int b = 0; b < index.count; b++) {
+        if(!ok[b]) allOk = false;
+        else blockCodecs[chosen[b]]++;
+    }
+
+    delete[] chosen;
+    delete[] ok;
+    return allOk;
+}
+
+QByteArray ContainerCompressor::compress(const QByteArray& input, int codec) {
+    QBuffer source;
+    source.setData(input);
+    source.open(QIODevice::ReadOnly);
+
+    QByteArray result;
+    QBuffer target(&result);
+    target.open(QIODevice::WriteOnly);
+    if(!compress(&source, &target, codec)) return QByteArray();
+    target.close();
+    return result;
+}
+
+// input is read one batch of blocks at a time and every block is
+// written as soon as it's coded, only the index waits for the end
+bool ContainerCompressor::compress(QIODevice* in, QIODevice* out, int codec) {
+    if(codec != AUTO && (codec < 0 || codec >= AutoCompressor::CODEC_COUNT)) return false;
+    for(int c = 0; c < AutoCompressor::CODEC_COUNT; c++) blockCodecs[c] = 0;
+
+    unsigned char word[8];
+    char header[HEADER_SIZE];
+    memcpy(header, HEADER_MAGIC, 4);
+    header[4] = (char)VERSION;
+    header[5] = (char)codec;
+    header[6] = (char)(ransCoding ? FLAG_RANS : 0);
+    header[7] = 0;
+    qToLittleEndian<quint32>((quint32)blockSize, header + 8);
+    if(!writeFully(out, header, HEADER_SIZE)) return false;
+
+    int batch = batchBlocks(blockSize);
+    qint64 batchBytes = (qint64)batch * blockSize;
+    char* data = new char[batchBytes];
+    QByteArray* packed = new QByteArray[batch];
+    unsigned char* chosen = new unsigned char[batch];
+    quint32* crcs = new quint32[batch];
+    bool* done = new bool[batch];
+
+    DynamicArray<qint64> offsets(64);
+    DynamicArray<int> sizes(64);
+    qint64 written = HEADER_SIZE;
+    qint64 total = 0;
+    bool ok = true;
+
+    while(ok) {
+        qint64 got = readUpTo(in, data, batchBytes);
+        if(got < 0) ok = false;
+        if(got <= 0) break;
+
+        encodeBlocks((const unsigned char*)data, got, codec, packed, chosen, crcs, done);
+
+        int blocks = (int)((got + blockSize - 1) / blockSize);
+        for(int b = 0; b < blocks && ok; b++) {
+            int size = blockBytes(got, blockSize, b);
+            bool stored = chosen[b] == AutoCompressor::STORED;
+            int packedSize = stored ? size : packed[b].size();
+            if(!done[b]) {
+                ok = false;
+                break;
+            }
+
+            char record[BLOCK_HEADER_SIZE];
+            record[0] = (char)chosen[b];
+            qToLittleEndian<quint32>((quint32)size, record + 1);
+            qToLittleEndian<quint32>((quint32)packedSize, record + 5);
+            qToLittleEndian<quint32>(crcs[b], record + 9);
+            ok = writeFully(out, record, BLOCK_HEADER_SIZE) &&
+                 writeFully(out, stored ? data + (qint64)b * blockSize : packed[b].constData(), packedSize);
+            packed[b] = QByteArray();
+
+            blockCodecs[chosen[b]]++;
+            offsets.add(written);
+            sizes.add(size);
+            written += BLOCK_HEADER_SIZE + packedSize;
+        }
+
+        total += got;
+        if(got < batchBytes) break;   // that was the end of the input
+    }
+
+    delete[] data;
+    delete[] packed;
+    delete[] chosen;
+    delete[] crcs;
+    delete[] done;
+    if(!ok) return false;
+
+    QByteArray tail;
+    tail.reserve(1 + sizes.size() * INDEX_ENTRY_SIZE + FOOTER_SIZE);
+    tail.append((char)END_OF_BLOCKS);
+    for(int b = 0; b < sizes.size(); b++) {
+        qToLittleEndian<quint64>((quint64)offsets[b], word);
+        tail.append((const char*)word, 8);
+        qToLittleEndian<quint32>((quint32)sizes[b], word);
+        tail.append((const char*)word, 4);
+    }
+
+    qToLittleEndian<quint64>((quint64)written, word);
+    tail.append((const char*)word, 8);
+    qToLittleEndian<quint32>((quint32)sizes.size(), word);
+    tail.append((const char*)word, 4);
+    qToLittleEndian<quint64>((quint64)total, word);
+    tail.append((const char*)word, 8);
+    quint32 crc = CRC32::update(0, (const unsigned char*)tail.constData(), tail.size());
+    qToLittleEndian<quint32>(crc, word);
+    tail.append((const char*)word, 4);
+    tail.append((const char*)FOOTER_MAGIC, 4);
+
+    return writeFully(out, tail.constData(), tail.size());
+}
+
+QByteArray ContainerCompressor::decompress(const QByteArray& input) {
+    for(int c = 0; c < AutoCompressor::CODEC_COUNT; c++) blockCodecs[c] = 0;
+    if(!isContainer(input)) return QByteArray();
+
+    const unsigned char* file = (const unsigned char*)input.constData();
+    if(!checkHeader(file)) return QByteArray();
+
+    ContainerIndex index;
+    qint64 needed = 0;
+    if(!readIndex(file, input.size(), input.size(), index, needed)) return QByteArray();
+    if(index.originalSize > 0x7FFFFFFF) return QByteArray();
+
+    QByteArray result;
+    result.resize((int)index.originalSize);
+    if(!decodeBlocks(file, index, result.data())) return QByteArray();
+    return result;
+}
+
+// blocks are read in order until the end marker, a batch at a time, so
+// this works on pipes too. The index at the end has to agree with what
+// came through
+bool ContainerCompressor::decompress(QIODevice* in, QIODevice* out) {
+    for(int c = 0; c < AutoCompressor::CODEC_COUNT; c++) blockCodecs[c] = 0;
+
+    unsigned char header[HEADER_SIZE];
+    if(!readFully(in, (char*)header, HEADER_SIZE) || !checkHeader(header)) return false;
+    int fileBlockSize = (int)qFromLittleEndian<quint32>(header + 8);
+    if(fileBlockSize < MIN_BLOCK_SIZE || fileBlockSize > MAX_BLOCK_SIZE) return false;
+
+    // a block never packs to more than its own size, so these bound memory
+    int batch = batchBlocks(fileBlockSize);
+    unsigned char* packed = new unsigned char[(qint64)batch * (BLOCK_HEADER_SIZE + fileBlockSize)];
+    char* data = new char[(qint64)batch * fileBlockSize];
+    ContainerIndex batchIndex;
+    batchIndex.allocate(batch);
+
+    DynamicArray<qint64> offsets(64);
+    DynamicArray<int> sizes(64);
+    qint64 pos = HEADER_SIZE;
+    bool ok = true;
+    bool end = false;
+
+    while(ok && !end) {
+        int n = 0;
+        qint64 used = 0, produced = 0;
+        while(n < batch) {
+            unsigned char* record = packed + used;
+            if(!readFully(in, (char*)record, 1)) {
+                ok = false;
+                break;
+            }
+            if(record[0] == END_OF_BLOCKS) {
+                end = true;
+                break;
+            }
+            if(!readFully(in, (char*)record + 1, BLOCK_HEADER_SIZE - 1)) {
+                ok = false;
+                break;
+            }
+            qint64 size = qFromLittleEndian<quint32>(record + 1);
+            qint64 packedSize = qFromLittleEndian<quint32>(record + 5);
+            if(size < 1 || size > fileBlockSize || packedSize > size ||
+               !readFully(in, (char*)record + BLOCK_HEADER_SIZE, packedSize)) {
+                ok = false;
+                break;
+            }
+
+            batchIndex.offsets[n] = used;
+            batchIndex.starts[n] = produced;
+            batchIndex.sizes[n] = (int)size;
+            offsets.add(pos);
+            sizes.add((int)size);
+            used += BLOCK_HEADER_SIZE + packedSize;
+            produced += size;
+            pos += BLOCK_HEADER_SIZE + packedSize;
+            n++;
+        }
+        if(!ok || n == 0) break;
+
+        batchIndex.count = n;
+        batchIndex.offsets[n] = used;
+        batchIndex.starts[n] = produced;
+        ok = decodeBlocks(packed, batchIndex, data) && writeFully(out, data, produced);
+        batchIndex.count = batch;
+    }
+
+    delete[] packed;
+    delete[] data;
+    if(!ok || !end) return false;
+
+    // the marker was already read, the rest of the tail follows it
+    qint64 tailSize = 1 + (qint64)sizes.size() * INDEX_ENTRY_SIZE + FOOTER_SIZE;
+    unsigned char* tail = new unsigned char[tailSize];
+    tail[0] = END_OF_BLOCKS;
+    ContainerIndex index;
+    qint64 needed = 0;
+    ok = readFully(in, (char*)tail + 1, tailSize - 1) &&
+         readIndex(tail, tailSize, pos + tailSize, index, needed) &&
+         index.count == sizes.size();
+    for(int b = 0; ok && b < index.count; b++) {
+        if(index.offsets[b] != offsets[b] || index.sizes[b] != sizes[b]) ok = false;
+    }
+    delete[] tail;
+    return ok;
+}
+
+QByteArray ContainerCompressor::decompressRange(const QByteArray& input, qint64 offset, qint64 length) {
+    QBuffer buffer;
+    buffer.setData(input);   // shares the data, nothing is copied
+    if(!buffer.open(QIODevice::ReadOnly)) return QByteArray();
+
+    ContainerReader reader;
+    if(!reader.open(&buffer)) return QByteArray();
+    return reader.read(offset, length);
+}
+
+// ---- ContainerReader ----
+
+// devices may hand out less than asked for, keep going until it's all there
+bool ContainerReader::readAt(qint64 pos, char* out, qint64 size) {
+    if(!device->seek(pos)) return false;
+    while(size > 0) {
+        qint64 got = device->read(out, size);
+        if(got <= 0) return false;
+        out += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool ContainerReader::open(QIODevice* input) {
+    device = input;
+    ready = false;
+    index.clear();
+    if(!device || device->isSequential()) return false;
+
+    qint64 fileSize = device->size();
+    if(fileSize < ContainerCompressor::HEADER_SIZE + ContainerCompressor::FOOTER_SIZE) return false;
+
+    unsigned char header[ContainerCompressor::HEADER_SIZE];
+    if(!readAt(0, (char*)header, sizeof(header))) return false;
+    if(!ContainerCompressor::checkHeader(header)) return false;
+
+    // the footer says how big the index is, then read both
+    unsigned char footer[ContainerCompressor::FOOTER_SIZE];
+    if(!readAt(fileSize - sizeof(footer), (char*)footer, sizeof(footer))) return false;
+    qint64 needed = 0;
+    if(ContainerCompressor::readIndex(footer, sizeof(footer), fileSize, index, needed)) {
+        ready = true;
+        return true;
+    }
+    if(needed <= (qint64)sizeof(footer)) return false;
+
+    unsigned char* tail = new unsigned char[needed];
+    bool ok = readAt(fileSize - needed, (char*)tail, needed) &&
+              ContainerCompressor::readIndex(tail, needed, fileSize, index, needed);
+    delete[] tail;
+
+    ready = ok;
+    return ok;
+}
+
+QByteArray ContainerReader::read(qint64 offset, qint64 length) {
+    if(!ready || offset < 0 || length <= 0 || offset >= index.originalSize) return QByteArray();
+    if(length > index.originalSize - offset) length = index.originalSize - offset;
+    if(length > 0x7FFFFFFF) return QByteArray();
+
+    int first = index.findBlock(offset);
+    int last = index.findBlock(offset + length - 1);
+    if(first < 0 || last < 0) return QByteArray();
+
+    QByteArray result;
+    result.resize((int)length);
+    char* out = result.data();
+
+    bool ok = true;
+    for(int b = first; b <= last && ok; b++) {
+        qint64 blockStart = index.starts[b];
+        int blockSize = index.sizes[b];
+        qint64 from = (offset > blockStart) ? offset - blockStart : 0;
+        qint64 to = offset + length - blockStart;
+        if(to > blockSize) to = blockSize;
+
+        qint64 packedBytes = index.offsets[b + 1] - index.offsets[b];
+        if(packedBytes > 0x7FFFFFFF) {
+            ok = false;
+            break;
+        }
+        QByteArray packed;
+        packed.resize((int)packedBytes);
+        if(!readAt(index.offsets[b], packed.data(), packedBytes)) {
+            ok = false;
+            break;
+        }
+
+        // whole blocks go straight into the result, the partial ones at
+        // the ends through a scratch buffer
+        char* target = out + (blockStart + from - offset);
+        bool whole = (from == 0 && to == blockSize);
+        char* scratch = whole ? nullptr : new char[blockSize];
+
+        int codec = 0;
+        ok = decodeBlock(codecs, (const unsigned char*)packed.constData(), packedBytes, blockSize,
+                         whole ? target : scratch, codec);
+        if(ok && !whole) memcpy(target, scratch + from, (size_t)(to - from));
+        delete[] scratch;
+    }
+
+    if(!ok) return QByteArray();
+    return result;
+}
@@ -0,0 +1,161 @@
+#ifndef CONTAINERCOMPRESSOR_H
+#define CONTAINERCOMPRESSOR_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include "autocompressor.h"
+
+// Block index of a container, filled by ContainerCompressor::readIndex
+class ContainerIndex {
+public:
+    int count;               // blocks
+    qint64 originalSize;     // sum of all block sizes
+    // count + 1 entries, the extra one is where the index starts
+    // and the original size
+    qint64* offsets;         // where each block header starts in the file
+    qint64* starts;          // where each block starts in the original data
+    int* sizes;              // original bytes per block
+
+    ContainerIndex() : count(0), originalSize(0), offsets(nullptr), starts(nullptr), sizes(nullptr) {}
+    ~ContainerIndex() { clear(); }
+
+    // owns the arrays, a copy would free them twice
+    ContainerIndex(const ContainerIndex&) = delete;
+    ContainerIndex& operator=(const ContainerIndex&) = delete;
+
+    void allocate(int blocks);
+    void clear();
+
+    // block holding original byte pos, -1 if past the end
+    int findBlock(qint64 pos) const;
+};
+
+// One file format for every codec: magic, version, codec id, flags, then
+// the input cut into blocks that each carry their codec, both sizes and
+// a CRC-32 of the original bytes. A block index at the end points at
+// every block, so blocks can be decoded in parallel or one at a time
+// Layout (little endian):
+//   header   [magic "CSPF" 4][version 1][codec 1][flags 1][0 1][block size 4]
+//   blocks   [codec 1][original size 4][compressed size 4][crc32 4][data]
+//   index    [END_OF_BLOCKS 1] then [block offset 8][original size 4] per block
+//   footer   [index offset 8][block count 4][original size 8]
+//            [crc32 of index and footer so far 4][magic "CSPE" 4]
+// The marker lets a reader going front to back see where the blocks
+// stop, without knowing the index
+class ContainerCompressor {
+    friend class ContainerTask;
+
+public:
+    static const int AUTO = 0xFF;   // codec byte when every block picked its own
+    static const int VERSION = 1;
+    static const int END_OF_BLOCKS = 0xFE;  // codec byte that starts the index
+    static const int HEADER_SIZE = 12;
+    static const int BLOCK_HEADER_SIZE = 13;
+    static const int INDEX_ENTRY_SIZE = 12;
+    static const int FOOTER_SIZE = 28;
+
+private:
+    static const int MIN_BLOCK_SIZE = 1 << 16;
+    static const int MAX_BLOCK_SIZE = 1 << 26;
+    static const unsigned char FLAG_RANS = 1;   // blocks used rANS where they could
+    static const int STREAM_BATCH = 1 << 26;     // input bytes held at once when streaming
+
+    int blockSize;
+    int threadCount;
+    bool ransCoding;
+
+    // what the last compress() or decompress() did
+    int blockCodecs[AutoCompressor::CODEC_COUNT];
+
+    // one set of codecs per worker thread, kept across batches and runs
+    // so their tables (LZW hash, LZ77 chains...) are only built once
+    AutoCompressor* workers;
+    int workerCount;
+
+    AutoCompressor* prepareWorkers(int tasks);
+
+    int batchBlocks(int bytesPerBlock) const;
+    void encodeBlocks(const unsigned char* data, qint64 size, int codec,
+                      QByteArray* packed, unsigned char* chosen, quint32* crcs, bool* ok);
+    bool decodeBlocks(const unsigned char* file, const ContainerIndex& index, char* out);
+
+public:
+    ContainerCompressor();
+    ~ContainerCompressor();
+
+    // owns the workers
+    ContainerCompressor(const ContainerCompressor&) = delete;
+    ContainerCompressor& operator=(const ContainerCompressor&) = delete;
+
+    // bigger blocks compress a little better, smaller ones are quicker to
+    // seek into. 1 MB by default
+    void setBlockSize(int bytes);
+    int getBlockSize() const { return blockSize; }
+    void setThreadCount(int threads);
+    void setRansCoding(bool enabled) { ransCoding = enabled; }
+
+    // header checks only, for telling containers from the older layouts
+    static bool isContainer(const QByteArray& input);
+    static int containerCodec(const QByteArray& input);
+
+    // magic, and a version and flags this build can read
+    // (header is the first HEADER_SIZE bytes)
+    static bool checkHeader(const unsigned char* header);
+
+    // index and footer from the last bytes of a file, tail holds the
+    // last tailSize bytes of a file fileSize long. needed tells how many
+    // tail bytes it takes when there weren't enough (0 = bad file)
+    static bool readIndex(const unsigned char* tail, qint64 tailSize, qint64 fileSize,
+                          ContainerIndex& index, qint64& needed);
+
+    // codec is an AutoCompressor id or AUTO
+    QByteArray compress(const QByteArray& input, int codec);
+    QByteArray decompress(const QByteArray& input);
+
+    // streaming: input is read in batches of blocks (at most 64 MB, one
+    // block per thread) and output goes out as each batch is done, so
+    // memory doesn't grow with the file. Neither device has to be
+    // seekable. Output written before a failure is left to the caller.
+    // Only the container streams: the single codec layouts start with
+    // the whole input's size or tables, so streaming one codec means
+    // picking it here by id
+    bool compress(QIODevice* in, QIODevice* out, int codec);
+    bool decompress(QIODevice* in, QIODevice* out);
+
+    // just length bytes from offset of the original data (cut short at
+    // the end), only the blocks covering them get decoded. Empty if the
+    // range is outside the data or the file is broken
+    static QByteArray decompressRange(const QByteArray& input, qint64 offset, qint64 length);
+
+    // blocks of the last run that used codec (stored = didn't shrink)
+    int getBlockCount(int codec) const { return blockCodecs[codec]; }
+};
+
+// Random access into a container on a seekable device (e.g. a QFile):
+// open() reads the header and the index at the end, after that every
+// read() seeks to and decodes only the blocks it needs, so a 4 KB slice
+// of a huge file costs one block, not the whole file
+class ContainerReader {
+private:
+    QIODevice* device;
+    ContainerIndex index;
+    AutoCompressor codecs;
+    bool ready;
+
+    bool readAt(qint64 pos, char* out, qint64 size);
+
+public:
+    ContainerReader() : device(nullptr), ready(false) {}
+    ~ContainerReader() {}
+
+    // the device has to be open for reading and stay open
+    bool open(QIODevice* input);
+    bool isOpen() const { return ready; }
+
+    qint64 size() const { return ready ? index.originalSize : 0; }
+    int blockCount() const { return ready ? index.count : 0; }
+
+    QByteArray read(qint64 offset, qint64 length);
+};
+
+#endif // CONTAINERCOMPRESSOR_H
@@ -1,19 +1,114 @@
 #include "datastructures.h"
 #include "huffmancompressor.h"
+#include <cstring>
+
+// Histogram kernel used by every coder
+// Four sets of counters take turns, so a run of the same byte bumps four
+// different counters instead of waiting on one (store forwarding stall).
+// 16 bytes are read per step and the sets are added up at the end
+void FrequencyTable::addBytes(const unsigned char* data, qint64 size) {
+    static const qint64 CHUNK = 1 << 30;  // keeps 32 bit lane counters safe
+
+    quint32 lanes[4][256];
+
+    while(size > 0) {
+        qint64 n = size < CHUNK ? size : CHUNK;
+        memset(lanes, 0, sizeof(lanes));
+
+        qint64 i = 0;
+        for(; i + 16 <= n; i += 16) {
+            quint32 w[4];
+            memcpy(w, data + i, 16);
+            for(int k = 0; k < 4; k++) {
+                lanes[0][w[k] & 0xFF]++;
+                lanes[1][(w[k] >> 8) & 0xFF]++;
+                lanes[2][(w[k] >> 16) & 0xFF]++;
+                lanes[3][w[k] >> 24]++;
+            }
+        }
+        for(; i < n; i++) {
+            lanes[0][data[i]]++;
+        }
+
+        for(int c = 0; c < 256; c++) {
+            unsigned long long total = (unsigned long long)lanes[0][c] + lanes[1][c] +
+                                       lanes[2][c] + lanes[3][c];
+            if(total != 0) {
+                if(counts[c] == 0) sz++;
+                counts[c] += total;
+            }
+        }
+
+        data += n;
+        size -= n;
+    }
+}
+
+// table k holds the crc of a byte followed by k zero bytes, so
+// 8 bytes can be folded in with 8 independent lookups
+struct CRC32Tables {
+    quint32 t[8][256];
+
+    CRC32Tables() {
+        for(int i = 0; i < 256; i++) {
+            quint32 c = (quint32)i;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[0][i] = c;
+        }
+        for(int i = 0; i < 256; i++) {
+            for(int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+    }
+};
+
+quint32 CRC32::update(quint32 crc, const unsigned char* data, qint64 size) {
+    static const CRC32Tables tables;   // built once, thread safe since C++11
+    const quint32 (*t)[256] = tables.t;
+
+    crc = ~crc;
+    while(size >= 8) {
+        quint32 lo = qFromLittleEndian<quint32>(data) ^ crc;
+        quint32 hi = qFromLittleEndian<quint32>(data + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while(size-- > 0) crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// pairs are scattered over 256 tables, so there's nothing to batch:
+// count straight into them and fix up the sizes once at the end
+void ContextFrequencyTable::addBytes(const unsigned char* data, qint64 size, unsigned char previous) {
+    for(qint64 i = 0; i < size; i++) {
+        tables[previous].counts[data[i]]++;
+        previous = data[i];
+    }
+
+    for(int p = 0; p < 256; p++) {
+        int distinct = 0;
+        for(int c = 0; c < 256; c++) {
+            if(tables[p].counts[c] != 0) distinct++;
+        }
+        tables[p].sz = distinct;
+    }
+}
 
 // MinHeap implementation for huffman tree building
 
-MinHeap::MinHeap(int capacity) : cap(capacity), sz(0) {
-    heap = new HuffmanNode*[cap];
+MinHeap::MinHeap(const HuffmanNode* nodeArray, int capacity)
+    : nodes(nodeArray), cap(capacity), sz(0) {
+    if(cap > MAX_CAPACITY) cap = MAX_CAPACITY;
 }
 
-MinHeap::~MinHeap() {
-    delete[] heap;
+unsigned long long MinHeap::freq(int i) const {
+    return nodes[heap[i]].frequency;
 }
 
 void MinHeap::heapifyUp(int idx) {
     // bubble up until heap property is satisfied
-    while(idx > 0 && heap[idx]->frequency < heap[parent(idx)]->frequency) {
+    while(idx > 0 && freq(idx) < freq(parent(idx))) {
         swap(idx, parent(idx));
         idx = parent(idx);
     }
@@ -25,9 +120,9 @@ void MinHeap::heapifyDown(int idx) {
     int right = rightChild(idx);
 
     // find smallest among node and its children
-    if(left < sz && heap[left]->frequency < heap[smallest]->frequency)
+    if(left < sz && freq(left) < freq(smallest))
         smallest = left;
-    if(right < sz && heap[right]->frequency < heap[smallest]->frequency)
+    if(right < sz && freq(right) < freq(smallest))
         smallest = right;
 
     // if smallest is not current node, swap and continue
@@ -37,7 +132,7 @@ void MinHeap::heapifyDown(int idx) {
     }
 }
 
-void MinHeap::insert(HuffmanNode* val) {
+void MinHeap::insert(int val) {
     if(sz >= cap) return;  // heap full
 
     heap[sz] = val;
@@ -45,10 +140,10 @@ void MinHeap::insert(HuffmanNode* val) {
     sz++;
 }
 
-HuffmanNode* MinHeap::extractMin() {
-    if(sz == 0) return nullptr;
+int MinHeap::extractMin() {
+    if(sz == 0) return -1;
 
-    HuffmanNode* minVal = heap[0];
+    int minVal = heap[0];
     heap[0] = heap[sz - 1];
     sz--;
 
@@ -2,6 +2,7 @@
 #define DATASTRUCTURES_H
 
 #include <QString>
+#include <QtEndian>
 
 // Dynamic Array class - because we cant use vector
 // This is our own implementation
@@ -45,6 +46,7 @@ public:
     int size() const { return sz; }
     void clear() { sz = 0; }
     T& operator[](int idx) { return arr[idx]; }
+    const T& operator[](int idx) const { return arr[idx]; }
 
     // bubble sort - simple but works fine for our purpose
     void sort() {
@@ -63,87 +65,46 @@ public:
     }
 };
 
-// Hash table for frequency counting
-// Using chaining in case of collisions
+// Frequency counting for all 256 byte values
+// Keys are already 0-255 so this is just a flat array of counters,
+// a character "exists" once its count is above zero
 class FrequencyTable {
+    friend class ContextFrequencyTable;
+
 private:
-    // node structure for linked list
-    struct Node {
-        unsigned char key;
-        unsigned long long value;
-        Node* next;
-        Node(unsigned char k, unsigned long long v) : key(k), value(v), next(nullptr) {}
-    };
-
-    Node* table[256];  // 256 slots for all possible chars
+    unsigned long long counts[256];
     int sz;            // how many entries we have
 
 public:
     FrequencyTable() : sz(0) {
-        // initialize everything to null
         for(int i = 0; i < 256; i++) {
-            table[i] = nullptr;
-        }
-    }
-
-    // destructor - need to delete all nodes
-    ~FrequencyTable() {
-        for(int i = 0; i < 256; i++) {
-            Node* curr = table[i];
-            while(curr) {
-                Node* temp = curr;
-                curr = curr->next;
-                delete temp;
-            }
+            counts[i] = 0;
         }
     }
 
     // insert or update a key-value pair
     void insert(unsigned char key, unsigned long long value) {
-        int idx = key;  // hash function is just the key itself
-        Node* curr = table[idx];
-
-        // check if key already exists
-        while(curr) {
-            if(curr->key == key) {
-                curr->value = value;  // update existing
-                return;
-            }
-            curr = curr->next;
-        }
-
-        // key doesn't exist, add new node at front
-        Node* newNode = new Node(key, value);
-        newNode->next = table[idx];
-        table[idx] = newNode;
-        sz++;
+        if(counts[key] == 0 && value != 0) sz++;
+        if(counts[key] != 0 && value == 0) sz--;
+        counts[key] = value;
     }
 
     // get value for a key
     unsigned long long* get(unsigned char key) {
-        int idx = key;
-        Node* curr = table[idx];
-
-        while(curr) {
-            if(curr->key == key) {
-                return &(curr->value);
-            }
-            curr = curr->next;
-        }
-        return nullptr;  // not found
+        if(counts[key] == 0) return nullptr;  // not found
+        return &counts[key];
     }
 
     // increment counter for a character
     void increment(unsigned char key) {
-        unsigned long long* val = get(key);
-        if(val) {
-            (*val)++;  // already exists, just increment
-        } else {
-            insert(key, 1);  // first time seeing this char
-        }
+        if(counts[key]++ == 0) sz++;
     }
 
+    // count a whole buffer at once, much faster than increment per byte
+    void addBytes(const unsigned char* data, qint64 size);
+
     int size() const { return sz; }
+    const unsigned long long* rawCounts() const { return counts; }
 
     // get all entries as two parallel arrays
     void getAllEntries(DynamicArray<unsigned char>& keys,
@@ -152,65 +113,177 @@ public:
         values.clear();
         // go through all slots
         for(int i = 0; i < 256; i++) {
-            Node* curr = table[i];
-            while(curr) {
-                keys.add(curr->key);
-                values.add(curr->value);
-                curr = curr->next;
+            if(counts[i] != 0) {
+                keys.add((unsigned char)i);
+                values.add(counts[i]);
             }
         }
     }
 };
 
+// Order 1 counts: one FrequencyTable per previous byte, so context(p)
+// says how often each byte came right after p (256 x 256 counters)
+class ContextFrequencyTable {
+private:
+    FrequencyTable* tables;   // 256 of them, half a MB so not on the stack
+
+public:
+    ContextFrequencyTable() { tables = new FrequencyTable[256]; }
+    ~ContextFrequencyTable() { delete[] tables; }
+
+    // count every byte under the one before it, the first one
+    // under 'previous' (what the coder starts with)
+    void addBytes(const unsigned char* data, qint64 size, unsigned char previous = 0);
+
+    const FrequencyTable& context(unsigned char previous) const { return tables[previous]; }
+    const unsigned long long* rawCounts(unsigned char previous) const { return tables[previous].rawCounts(); }
+};
+
 // Store huffman codes for each character
 // Direct addressing - index is the character itself
+// A code is kept as a plain integer, its low 'length' bits are the code
 class CodeTable {
 private:
-    QString codes[256];   // the huffman code for each char
-    bool exists[256];     // track which ones we have
+    quint64 codes[256];           // the huffman code for each char
+    unsigned char lengths[256];   // code length in bits, 0 = no code
 
 public:
     CodeTable() {
         // mark all as non-existent initially
         for(int i = 0; i < 256; i++) {
-            exists[i] = false;
+            codes[i] = 0;
+            lengths[i] = 0;
         }
     }
 
-    void insert(unsigned char key, const QString& code) {
+    void insert(unsigned char key, quint64 code, int length) {
         codes[key] = code;
-        exists[key] = true;
+        lengths[key] = (unsigned char)length;
+    }
+
+    quint64 getCode(unsigned char key) const { return codes[key]; }
+    int getLength(unsigned char key) const { return lengths[key]; }
+
+    bool contains(unsigned char key) const {
+        return lengths[key] != 0;
     }
+};
+
+// Reads a buffer one bit at a time, most significant bit first
+// Keeps up to 64 bits cached so peeking a few bits is just a shift
+// Reading past the end gives zero bits
+class BitReader {
+private:
+    const unsigned char* start;
+    const unsigned char* src;
+    const unsigned char* end;
+    quint64 buf;   // cached bits, next bit is the top one
+    int count;     // how many cached bits are valid
 
-    QString* get(unsigned char key) {
-        if(exists[key]) {
-            return &codes[key];
+public:
+    BitReader(const unsigned char* data, qint64 size)
+        : start(data), src(data), end(data + size), buf(0), count(0) {}
+
+    // make sure at least 56 bits are cached
+    void refill() {
+        if(end - src >= 8) {
+            // grab 8 bytes at once, only the whole bytes that fit are consumed
+            buf |= qFromBigEndian<quint64>(src) >> count;
+            src += (63 - count) >> 3;
+            count |= 56;
+        } else {
+            while(count <= 56) {
+                quint64 byte = (src < end) ? *src++ : 0;
+                buf |= byte << (56 - count);
+                count += 8;
+            }
         }
-        return nullptr;
     }
 
-    bool contains(unsigned char key) const {
-        return exists[key];
+    // look at the next n bits without consuming them (1 <= n <= 56)
+    unsigned int peek(int n) const { return (unsigned int)(buf >> (64 - n)); }
+    void skip(int n) { buf <<= n; count -= n; }
+
+    // number of bits consumed so far
+    qint64 position() const { return (qint64)(src - start) * 8 - count; }
+
+    unsigned int read(int n) {
+        if(count < n) refill();
+        unsigned int val = peek(n);
+        skip(n);
+        return val;
     }
 };
 
+// Packs bits most significant first straight into a caller sized buffer
+// Whole 64 bit words are stored at once, so the buffer needs 8 spare bytes
+// past the last byte that will really be used
+class BitWriter {
+private:
+    unsigned char* start;
+    unsigned char* dst;
+    quint64 buf;   // pending bits, first one at the top
+    int count;     // how many pending bits
+
+public:
+    BitWriter(unsigned char* out) : start(out), dst(out), buf(0), count(0) {}
+
+    // append the low n bits of bits (1 <= n <= 57)
+    void write(quint64 bits, int n) {
+        if(count + n > 64) {
+            // store the word and keep only the unfinished byte
+            qToBigEndian<quint64>(buf, dst);
+            int bytes = count >> 3;
+            dst += bytes;
+            buf = (bytes < 8) ? (buf << (bytes * 8)) : 0;
+            count &= 7;
+        }
+        buf |= bits << (64 - count - n);
+        count += n;
+    }
+
+    // write out whatever is pending, last byte padded with zeros
+    void flush() {
+        qToBigEndian<quint64>(buf, dst);
+        dst += (count + 7) >> 3;
+        buf = 0;
+        count = 0;
+    }
+
+    // bytes stored so far (call flush first for the exact total)
+    qint64 bytesWritten() const { return dst - start; }
+};
+
+// CRC-32 (the zip / png one), 8 bytes per step with 8 lookup tables
+// start with crc = 0 and feed the data in as many pieces as you like
+class CRC32 {
+public:
+    static quint32 update(quint32 crc, const unsigned char* data, qint64 size);
+};
+
 // forward declaration
 struct HuffmanNode;
 
 // Min heap for building huffman tree
 // Need to repeatedly get the two minimum frequency nodes
+// holds indices into a node array, storage is fixed so nothing is allocated
 class MinHeap {
 private:
-    HuffmanNode** heap;  // array of pointers to nodes
-    int cap;             // capacity
-    int sz;              // current size
+    static const int MAX_CAPACITY = 512;
+
+    const HuffmanNode* nodes;     // node array the indices point into
+    int heap[MAX_CAPACITY];       // node indices
+    int cap;                      // capacity
+    int sz;                       // current size
+
+    unsigned long long freq(int i) const;
 
     int parent(int i) { return (i - 1) / 2; }
     int leftChild(int i) { return 2 * i + 1; }
     int rightChild(int i) { return 2 * i + 2; }
 
     void swap(int i, int j) {
-        HuffmanNode* temp = heap[i];
+        int temp = heap[i];
         heap[i] = heap[j];
         heap[j] = temp;
     }
@@ -219,11 +292,10 @@ private:
     void heapifyDown(int idx);
 
 public:
-    MinHeap(int capacity = 256);
-    ~MinHeap();
+    MinHeap(const HuffmanNode* nodeArray, int capacity = 256);
 
-    void insert(HuffmanNode* val);
-    HuffmanNode* extractMin();
+    void insert(int val);
+    int extractMin();    // -1 when empty
 
     int size() const { return sz; }
     bool isEmpty() const { return sz == 0; }
@@ -1,40 +1,60 @@
 #include "huffmancompressor.h"
+#include "huffmanpresets.h"
+#include "ranscoder.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QBuffer>
+#include <cstring>
 
-HuffmanCompressor::HuffmanCompressor() : root(nullptr) {}
+HuffmanCompressor::HuffmanCompressor()
+    : nodeCount(0), root(-1), maxCodeLength(MAX_CODE_LENGTH),
+      blockSize(0), fourStreams(false), contextModel(false), ransCoding(false), threadCount(QThread::idealThreadCount()),
+      loadedPreset(-1) {
+    if(threadCount < 1) threadCount = 1;
+}
 
 HuffmanCompressor::~HuffmanCompressor() {
-    if(root) deleteTree(root);
 }
 
-void HuffmanCompressor::deleteTree(HuffmanNode* node) {
-    if(!node) return;
-    deleteTree(node->left);
-    deleteTree(node->right);
-    delete node;
+HuffmanCodes::HuffmanCodes() : primaryBits(0) {
+    clear();
 }
 
-void HuffmanCompressor::buildFrequencyTable(const QByteArray& data) {
-    freqTable = FrequencyTable(); // reset table
-    for(int i = 0; i < data.size(); i++) {
-        freqTable.increment((unsigned char)data[i]);
-    }
+void HuffmanCodes::clear() {
+    for(int c = 0; c < 256; c++) lengths[c] = 0;
+    table = CodeTable();
+    decodeTable.clear();
+    primaryBits = 0;
 }
 
-HuffmanNode* HuffmanCompressor::buildHuffmanTree() {
-    MinHeap minHeap(256);
+void HuffmanCompressor::setMaxCodeLength(int bits) {
+    // 8 bits is the least that still fits all 256 characters
+    if(bits < 8) bits = 8;
+    if(bits > MAX_CODE_LENGTH) bits = MAX_CODE_LENGTH;
+    maxCodeLength = bits;
+}
 
-    DynamicArray<unsigned char> keys;
-    DynamicArray<unsigned long long> values;
-    freqTable.getAllEntries(keys, values);
+void HuffmanCompressor::buildFrequencyTable(const unsigned char* data, int size) {
+    freqTable = FrequencyTable(); // reset table
+    freqTable.addBytes(data, size);
+}
 
-    if(keys.size() == 0) return nullptr;
+// returns root index, nodes are taken from the arena (old tree is dropped)
+int HuffmanCompressor::buildHuffmanTree() {
+    MinHeap minHeap(nodes, 256);
+    nodeCount = 0;
 
     // add all characters as leaf nodes
-    for(int i = 0; i < keys.size(); i++) {
-        HuffmanNode* node = new HuffmanNode(keys[i], values[i]);
-        minHeap.insert(node);
+    const unsigned long long* counts = freqTable.rawCounts();
+    for(int c = 0; c < 256; c++) {
+        if(counts[c] == 0) continue;
+        nodes[nodeCount] = HuffmanNode((unsigned char)c, counts[c]);
+        minHeap.insert(nodeCount++);
     }
 
+    if(nodeCount == 0) return -1;
+
     // special case: only one unique character
     if(minHeap.size() == 1) {
         return minHeap.extractMin();
@@ -42,95 +62,1009 @@ HuffmanNode* HuffmanCompressor::buildHuffmanTree() {
 
     // build tree by combining two minimum nodes repeatedly
     while(minHeap.size() > 1) {
-        HuffmanNode* left = minHeap.extractMin();
-        HuffmanNode* right = minHeap.extractMin();
+        int left = minHeap.extractMin();
+        int right = minHeap.extractMin();
 
-        HuffmanNode* parent = new HuffmanNode(0, left->frequency + right->frequency);
-        parent->left = left;
-        parent->right = right;
+        HuffmanNode& parent = nodes[nodeCount];
+        parent = HuffmanNode(0, nodes[left].frequency + nodes[right].frequency);
+        parent.left = (unsigned short)left;
+        parent.right = (unsigned short)right;
 
-        minHeap.insert(parent);
+        minHeap.insert(nodeCount++);
     }
 
     return minHeap.extractMin();
 }
 
-void HuffmanCompressor::generateCodes(HuffmanNode* node, QString code) {
-    if(!node) return;
+// code length of each character is just its depth in the tree
+void HuffmanCompressor::collectCodeLengths(int node, int depth, unsigned char* lengths) {
+    if(node < 0) return;
 
-    if(node->isLeaf()) {
-        codeTable.insert(node->character, code.isEmpty() ? "0" : code);
+    const HuffmanNode& n = nodes[node];
+    if(n.isLeaf()) {
+        // lone character still needs one bit
+        lengths[n.character] = (unsigned char)(depth == 0 ? 1 : depth);
         return;
     }
 
-    generateCodes(node->left, code + "0");
-    generateCodes(node->right, code + "1");
+    collectCodeLengths(n.left, depth + 1, lengths);
+    collectCodeLengths(n.right, depth + 1, lengths);
 }
 
-// save tree in binary format
-void HuffmanCompressor::serializeTreeBinary(HuffmanNode* node, QByteArray& output) {
-    if(!node) {
-        output.append((char)0); // null marker
-        return;
+// squeeze the tree depths so no code is longer than maxLength
+// codes that are too long are cut to maxLength, which overfills the code
+// space, then shorter codes are pushed one level down until it fits again
+// (same rebalancing trick as zlib/miniz use)
+void HuffmanCodes::limitCodeLengths(int maxLength) {
+    int lengthCount[MAX_CODE_LENGTH + 1];
+    for(int len = 0; len <= MAX_CODE_LENGTH; len++) lengthCount[len] = 0;
+
+    bool tooLong = false;
+    for(int c = 0; c < 256; c++) {
+        int len = lengths[c];
+        if(len == 0) continue;
+        if(len > maxLength) {
+            len = maxLength;
+            tooLong = true;
+        }
+        lengthCount[len]++;
     }
+    if(!tooLong) return;
 
-    if(node->isLeaf()) {
-        output.append((char)1); // leaf marker
-        output.append((char)node->character);
-    } else {
-        output.append((char)2); // internal node marker
-        serializeTreeBinary(node->left, output);
-        serializeTreeBinary(node->right, output);
+    // kraft sum measured in units of 2^-maxLength
+    quint64 total = 0;
+    for(int len = 1; len <= maxLength; len++) {
+        total += (quint64)lengthCount[len] << (maxLength - len);
+    }
+
+    while(total > (1ULL << maxLength)) {
+        // drop one deepest code and split a shorter one into two
+        lengthCount[maxLength]--;
+        for(int len = maxLength - 1; len > 0; len--) {
+            if(lengthCount[len]) {
+                lengthCount[len]--;
+                lengthCount[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // hand the lengths back out, characters that had the shortest codes
+    // (the most frequent ones) keep getting the shortest codes
+    unsigned char order[256];
+    int n = 0;
+    for(int len = 1; len <= 255; len++) {
+        for(int c = 0; c < 256; c++) {
+            if(lengths[c] == len) order[n++] = (unsigned char)c;
+        }
+    }
+
+    int next = 0;
+    for(int len = 1; len <= maxLength; len++) {
+        for(int k = 0; k < lengthCount[len]; k++) {
+            lengths[order[next++]] = (unsigned char)len;
+        }
     }
 }
 
-// rebuild tree from binary data
-HuffmanNode* HuffmanCompressor::deserializeTreeBinary(const QByteArray& data, int& pos) {
-    if(pos >= data.size()) return nullptr;
+// canonical huffman: codes only depend on the lengths
+// shorter codes come first, equal lengths are ordered by character,
+// and each code is the previous one plus one (shifted when length grows)
+void HuffmanCodes::buildCanonicalCodes() {
+    int lengthCount[MAX_CODE_LENGTH + 1];
+    for(int len = 0; len <= MAX_CODE_LENGTH; len++) lengthCount[len] = 0;
+    for(int c = 0; c < 256; c++) lengthCount[lengths[c]]++;
+    lengthCount[0] = 0;
 
-    unsigned char marker = (unsigned char)data[pos++];
+    quint64 nextCode[MAX_CODE_LENGTH + 1];
+    quint64 code = 0;
+    nextCode[0] = 0;
+    for(int len = 1; len <= MAX_CODE_LENGTH; len++) {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
 
-    if(marker == 0) { // null
-        return nullptr;
-    } else if(marker == 1) { // leaf node
-        if(pos >= data.size()) return nullptr;
-        unsigned char ch = (unsigned char)data[pos++];
-        return new HuffmanNode(ch, 0);
-    } else if(marker == 2) { // internal node
-        HuffmanNode* node = new HuffmanNode(0, 0);
-        node->left = deserializeTreeBinary(data, pos);
-        node->right = deserializeTreeBinary(data, pos);
-        return node;
+    table = CodeTable(); // reset
+    for(int c = 0; c < 256; c++) {
+        int len = lengths[c];
+        if(len > 0) {
+            table.insert((unsigned char)c, nextCode[len]++, len);
+        }
     }
+}
 
-    return nullptr;
+// header is just the 256 code lengths, runs of unused characters
+// are squeezed into a 0 byte followed by (run length - 1)
+void HuffmanCodes::writeCodeLengths(QByteArray& output) const {
+    int c = 0;
+    while(c < 256) {
+        if(lengths[c] != 0) {
+            output.append((char)lengths[c]);
+            c++;
+            continue;
+        }
+
+        int run = 1;
+        while(c + run < 256 && lengths[c + run] == 0) run++;
+        output.append((char)0);
+        output.append((char)(run - 1));
+        c += run;
+    }
 }
 
-QByteArray HuffmanCompressor::compress(const QByteArray& input) {
-    if(input.isEmpty()) return QByteArray();
+bool HuffmanCodes::readCodeLengths(const QByteArray& data, int& pos) {
+    int c = 0;
+    while(c < 256) {
+        if(pos >= data.size()) return false;
+        unsigned char len = (unsigned char)data[pos++];
+
+        if(len != 0) {
+            if(len > MAX_CODE_LENGTH) return false;
+            lengths[c++] = len;
+            continue;
+        }
+
+        if(pos >= data.size()) return false;
+        int run = (unsigned char)data[pos++] + 1;
+        if(c + run > 256) return false;
+        for(int i = 0; i < run; i++) lengths[c++] = 0;
+    }
+    return true;
+}
+
+// reserve 2^bits empty slots at the end of the table, returns first index
+int HuffmanCodes::allocTable(int bits) {
+    int start = decodeTable.size();
+    for(int i = 0; i < (1 << bits); i++) {
+        decodeTable.add(DecodeEntry());
+    }
+    return start;
+}
 
-    // cleanup old tree if exists
-    if(root) {
-        deleteTree(root);
-        root = nullptr;
+// fill one table from symbols[first..last), all of them share the same
+// first 'consumed' bits. Canonical codes are sorted, so codes that run past
+// this table and share a slot sit next to each other and get a sub table
+void HuffmanCodes::fillDecodeTable(const unsigned char* symbols, int first, int last,
+                                        int consumed, int tableStart, int tableBits) {
+    int i = first;
+    while(i < last) {
+        unsigned char sym = symbols[i];
+        int rem = lengths[sym] - consumed;     // bits left for this table
+        quint64 code = table.getCode(sym);
+
+        if(rem <= tableBits) {
+            DecodeEntry entry;
+            entry.value = sym;
+            entry.length = (unsigned char)rem;
+
+            // a short code owns all slots that share its prefix
+            int slot = (int)(code & ((1ULL << rem) - 1)) << (tableBits - rem);
+            int count = 1 << (tableBits - rem);
+            for(int k = 0; k < count; k++) {
+                decodeTable[tableStart + slot + k] = entry;
+            }
+            i++;
+            continue;
+        }
+
+        int slot = (int)((code >> (rem - tableBits)) & ((1ULL << tableBits) - 1));
+
+        // collect every longer code going through the same slot
+        int j = i + 1;
+        int deepest = lengths[sym];
+        while(j < last) {
+            unsigned char next = symbols[j];
+            int nextRem = lengths[next] - consumed;
+            quint64 nextCode = table.getCode(next);
+            if((int)((nextCode >> (nextRem - tableBits)) & ((1ULL << tableBits) - 1)) != slot) break;
+            deepest = lengths[next];
+            j++;
+        }
+
+        int subBits = deepest - consumed - tableBits;
+        if(subBits > SUB_TABLE_BITS) subBits = SUB_TABLE_BITS;
+        int subStart = allocTable(subBits);
+        fillDecodeTable(symbols, i, j, consumed + tableBits, subStart, subBits);
+
+        DecodeEntry link;
+        link.value = (unsigned int)subStart;
+        link.subBits = (unsigned char)subBits;
+        decodeTable[tableStart + slot] = link;
+
+        i = j;
     }
+}
+
+// build the lookup tables straight from the code lengths
+// returns false if the lengths can't be a valid prefix code
+bool HuffmanCodes::buildDecodeTable() {
+    int lengthCount[MAX_CODE_LENGTH + 1];
+    for(int len = 0; len <= MAX_CODE_LENGTH; len++) lengthCount[len] = 0;
 
-    buildFrequencyTable(input);
+    int maxLen = 0;
+    for(int c = 0; c < 256; c++) {
+        lengthCount[lengths[c]]++;
+        if(lengths[c] > maxLen) maxLen = lengths[c];
+    }
+    if(maxLen == 0) return false;
+
+    // too many short codes means some of them would overlap
+    qint64 left = 1;
+    for(int len = 1; len <= maxLen; len++) {
+        left = left * 2 - lengthCount[len];
+        if(left < 0) return false;
+    }
+
+    buildCanonicalCodes();
+
+    // characters in canonical order (by length, then by value)
+    unsigned char symbols[256];
+    int n = 0;
+    for(int len = 1; len <= maxLen; len++) {
+        for(int c = 0; c < 256; c++) {
+            if(lengths[c] == len) symbols[n++] = (unsigned char)c;
+        }
+    }
+
+    decodeTable.clear();
+    primaryBits = maxLen;
+    if(primaryBits > PRIMARY_TABLE_BITS) primaryBits = PRIMARY_TABLE_BITS;
+
+    int start = allocTable(primaryBits);
+    fillDecodeTable(symbols, 0, n, 0, start, primaryBits);
+    return true;
+}
+
+int HuffmanCodes::countCodes(unsigned char& onlyChar) const {
+    int distinct = 0;
+    for(int c = 0; c < 256; c++) {
+        if(lengths[c] != 0) {
+            distinct++;
+            onlyChar = (unsigned char)c;
+        }
+    }
+    return distinct;
+}
+
+// codes read from a file replace whatever preset was loaded
+bool HuffmanCompressor::readCodeLengths(const QByteArray& data, int& pos) {
+    loadedPreset = -1;
+    return codes.readCodeLengths(data, pos);
+}
+
+// histogram, tree and canonical codes for one run of input
+bool HuffmanCompressor::buildCodes(const unsigned char* data, int size) {
+    buildFrequencyTable(data, size);
+    return buildCodesFromTable(maxCodeLength, codes);
+}
+
+// tree and canonical codes for whatever is in freqTable, into target
+bool HuffmanCompressor::buildCodesFromTable(int maxLength, HuffmanCodes& target) {
+    if(&target == &codes) loadedPreset = -1;
     root = buildHuffmanTree();
 
-    if(!root) return QByteArray();
+    if(root < 0) return false;
+
+    // only the code lengths are kept, the arena is reused by the next build
+    for(int c = 0; c < 256; c++) target.lengths[c] = 0;
+    collectCodeLengths(root, 0, target.lengths);
+
+    target.limitCodeLengths(maxLength);
+    target.buildCanonicalCodes();
+    return true;
+}
+
+// exact size of the coded data in bits
+// with a single distinct character the header alone says it all
+qint64 HuffmanCompressor::countBits(const unsigned char* data, int size) {
+    unsigned char onlyChar = 0;
+    if(codes.countCodes(onlyChar) == 1) return 0;
+
+    qint64 totalBits = 0;
+    for(int i = 0; i < size; i++) {
+        totalBits += codes.table.getLength(data[i]);
+    }
+    return totalBits;
+}
+
+// append the padding byte and the packed codes for data
+bool HuffmanCompressor::writeBits(const unsigned char* data, int size, QByteArray& output) {
+    // work out the exact size of the bit stream up front
+    qint64 totalBits = countBits(data, size);
+
+    // calculate padding
+    int padding = (int)((8 - (totalBits % 8)) % 8);
+    output.append((char)padding);
+
+    return appendCodes(data, size, totalBits, output);
+}
+
+// pack the codes of data (totalBits worth) onto the end of output
+bool HuffmanCompressor::appendCodes(const unsigned char* data, int size, qint64 totalBits,
+                                    QByteArray& output) {
+    // encode straight into the output, with room for the last 64 bit store
+    qint64 dataBytes = (totalBits + 7) / 8;
+    if(output.size() + dataBytes + 8 > 0x7FFFFFFF) return false;
+
+    int dataStart = output.size();
+    output.resize(dataStart + (int)dataBytes + 8);
+    BitWriter writer((unsigned char*)output.data() + dataStart);
+
+    if(totalBits > 0) {
+        for(int i = 0; i < size; i++) {
+            writer.write(codes.table.getCode(data[i]), codes.table.getLength(data[i]));
+        }
+        writer.flush();
+    }
 
-    codeTable = CodeTable(); // reset
-    generateCodes(root, "");
+    output.resize(dataStart + (int)dataBytes);
+    return true;
+}
+
+// the block is cut into four equal parts, each one coded as its own
+// [padding][bits] stream. A jump table with the sizes of the first three
+// streams comes first so the decoder can find all of them up front
+bool HuffmanCompressor::writeStreams(const unsigned char* data, int size, QByteArray& output) {
+    int part = (size + 3) / 4;
+
+    int jumpTable = output.size();
+    for(int i = 0; i < 12; i++) output.append((char)0);
 
-    // encode to bit string
-    QString bitString = "";
-    for(int i = 0; i < input.size(); i++) {
-        QString* code = codeTable.get((unsigned char)input[i]);
-        if(code) {
-            bitString += *code;
+    for(int s = 0; s < 4; s++) {
+        int first = s * part;
+        int count = (s == 3) ? size - first : part;
+        if(first > size) first = size;
+        if(count > size - first) count = size - first;
+        if(count < 0) count = 0;
+
+        int start = output.size();
+        if(!writeBits(data + first, count, output)) return false;
+
+        if(s < 3) {
+            int streamSize = output.size() - start;
+            for(int i = 0; i < 4; i++) {
+                output[jumpTable + s * 4 + i] = (char)((streamSize >> (i * 8)) & 0xFF);
+            }
         }
     }
+    return true;
+}
+
+// decode one character, -1 if the bits don't match any code
+// the fast path assumes the caller refilled recently enough for a primary lookup
+static inline int decodeSymbol(BitReader& reader, const DecodeEntry* table, int primaryBits) {
+    DecodeEntry entry = table[reader.peek(primaryBits)];
+    if(entry.length != 0) {
+        reader.skip(entry.length);
+        return (int)entry.value;
+    }
+
+    // long code, follow the links into sub tables
+    int tableBits = primaryBits;
+    while(entry.length == 0) {
+        if(entry.subBits == 0) return -1;
+        reader.skip(tableBits);
+        reader.refill();
+        tableBits = entry.subBits;
+        entry = table[entry.value + reader.peek(tableBits)];
+    }
+    reader.skip(entry.length);
+    return (int)entry.value;
+}
+
+// decode exactly count characters from [padding byte][bits] into out,
+// code lengths must already be loaded
+bool HuffmanCompressor::decodeBits(const unsigned char* data, int size, char* out, qint64 count) {
+    if(size < 1) return false;
+
+    // read padding
+    int padding = data[0];
+    data++;
+    size--;
+
+    // handle single character case
+    unsigned char onlyChar = 0;
+    int distinct = codes.countCodes(onlyChar);
+    if(distinct == 0) return false;
+    if(distinct == 1) {
+        memset(out, onlyChar, (size_t)count);
+        return true;
+    }
+
+    // every symbol takes at least one bit
+    qint64 totalBits = (qint64)size * 8 - padding;
+    if(count > totalBits) return false;
+
+    if(!codes.buildDecodeTable()) return false;
+    return decodeCodes(data, size, totalBits, out, count);
+}
+
+// the decode loop itself, tables must be built and totalBits is how much
+// of data really holds codes
+bool HuffmanCompressor::decodeCodes(const unsigned char* data, int size, qint64 totalBits,
+                                    char* out, qint64 count) {
+    const DecodeEntry* table = &codes.decodeTable[0];
+    int primaryBits = codes.primaryBits;
+
+    qint64 produced = 0;
+    BitReader reader(data, size);
+
+    while(produced < count) {
+        reader.refill();
+
+        // short codes resolve in the primary table, four of them fit per refill
+        int room = 4;
+        DecodeEntry entry = table[reader.peek(primaryBits)];
+        while(entry.length != 0 && room > 0 && produced < count) {
+            reader.skip(entry.length);
+            out[produced++] = (char)entry.value;
+            room--;
+            entry = table[reader.peek(primaryBits)];
+        }
+        if(entry.length != 0 || produced >= count) continue;
+
+        // long code, follow the links into sub tables
+        int tableBits = primaryBits;
+        while(entry.length == 0) {
+            if(entry.subBits == 0) return false;  // no such code
+            reader.skip(tableBits);
+            reader.refill();
+            tableBits = entry.subBits;
+            entry = table[entry.value + reader.peek(tableBits)];
+        }
+        reader.skip(entry.length);
+        out[produced++] = (char)entry.value;
+    }
+
+    // decoding into the padding means the data was cut short
+    return reader.position() <= totalBits;
+}
+
+// counterpart of writeStreams: four readers walk their own stream in
+// the same loop, so their table lookups don't wait on each other
+bool HuffmanCompressor::decodeStreams(const unsigned char* data, int size, char* out, qint64 count) {
+    if(size < 12) return false;
+
+    // where each stream starts and how long it is
+    const unsigned char* streamData[4];
+    int streamSize[4];
+    int pos = 12;
+    for(int s = 0; s < 3; s++) {
+        int len = 0;
+        for(int i = 0; i < 4; i++) len |= (int)data[s * 4 + i] << (i * 8);
+        if(len < 1 || len > size - pos) return false;
+        streamData[s] = data + pos;
+        streamSize[s] = len;
+        pos += len;
+    }
+    if(pos >= size) return false;
+    streamData[3] = data + pos;
+    streamSize[3] = size - pos;
+
+    qint64 part = (count + 3) / 4;
+    char* streamOut[4];
+    qint64 streamCount[4];
+    for(int s = 0; s < 4; s++) {
+        qint64 first = s * part;
+        qint64 len = (s == 3) ? count - first : part;
+        if(first > count) first = count;
+        if(len > count - first) len = count - first;
+        if(len < 0) len = 0;
+        streamOut[s] = out + first;
+        streamCount[s] = len;
+    }
+
+    // the repeated character case and tiny blocks don't need the fast loop
+    unsigned char onlyChar = 0;
+    if(codes.countCodes(onlyChar) == 1 || streamCount[3] == 0) {
+        for(int s = 0; s < 4; s++) {
+            if(!decodeBits(streamData[s], streamSize[s], streamOut[s], streamCount[s])) return false;
+        }
+        return true;
+    }
+
+    if(!codes.buildDecodeTable()) return false;
+    const DecodeEntry* table = &codes.decodeTable[0];
+    int primaryBits = codes.primaryBits;
+
+    qint64 totalBits[4];
+    for(int s = 0; s < 4; s++) {
+        totalBits[s] = (qint64)(streamSize[s] - 1) * 8 - streamData[s][0];
+        if(streamCount[s] > totalBits[s]) return false;
+    }
+
+    BitReader r0(streamData[0] + 1, streamSize[0] - 1);
+    BitReader r1(streamData[1] + 1, streamSize[1] - 1);
+    BitReader r2(streamData[2] + 1, streamSize[2] - 1);
+    BitReader r3(streamData[3] + 1, streamSize[3] - 1);
+
+    // the last stream is the shortest, all four run together until it ends
+    // four primary lookups fit in one refill
+    qint64 common = streamCount[3];
+    qint64 i = 0;
+    while(i < common) {
+        r0.refill();
+        r1.refill();
+        r2.refill();
+        r3.refill();
+
+        qint64 stop = i + 4;
+        if(stop > common) stop = common;
+        for(; i < stop; i++) {
+            int c0 = decodeSymbol(r0, table, primaryBits);
+            int c1 = decodeSymbol(r1, table, primaryBits);
+            int c2 = decodeSymbol(r2, table, primaryBits);
+            int c3 = decodeSymbol(r3, table, primaryBits);
+            if((c0 | c1 | c2 | c3) < 0) return false;
+
+            streamOut[0][i] = (char)c0;
+            streamOut[1][i] = (char)c1;
+            streamOut[2][i] = (char)c2;
+            streamOut[3][i] = (char)c3;
+        }
+    }
+
+    // the last stream has to have used its bits exactly up to the padding
+    if(r3.position() > totalBits[3]) return false;
+
+    // leftovers of the first three streams, each reader is copied out
+    // so the ones above never have their address taken
+    for(int s = 0; s < 3; s++) {
+        BitReader reader = (s == 0) ? r0 : (s == 1) ? r1 : r2;
+        for(qint64 k = common; k < streamCount[s]; k++) {
+            reader.refill();
+            int c = decodeSymbol(reader, table, primaryBits);
+            if(c < 0) return false;
+            streamOut[s][k] = (char)c;
+        }
+
+        // decoding into the padding means the data was cut short
+        if(reader.position() > totalBits[s]) return false;
+    }
+
+    return true;
+}
+
+// ---- order 1 mode ----
+
+// one code table per group of contexts: rebuild every table from the
+// counts of the contexts mapped to it. bits gets what coding the block
+// with these tables costs, header included
+void HuffmanCompressor::buildContextTables(const ContextFrequencyTable& pairs, const unsigned char* contextMap,
+                                           int tableCount, HuffmanCodes* tables, qint64& bits) {
+    unsigned long long* sums = new unsigned long long[tableCount * 256];
+    memset(sums, 0, sizeof(unsigned long long) * tableCount * 256);
+    bool used[MAX_CONTEXT_TABLES] = {false};
+
+    for(int p = 0; p < 256; p++) {
+        const FrequencyTable& context = pairs.context((unsigned char)p);
+        if(context.size() == 0) continue;
+        const unsigned long long* counts = context.rawCounts();
+        unsigned long long* sum = sums + contextMap[p] * 256;
+        for(int c = 0; c < 256; c++) sum[c] += counts[c];
+        used[contextMap[p]] = true;
+    }
+
+    bits = tableCount > 1 ? 256 * 8 : 0;   // the context map
+    for(int t = 0; t < tableCount; t++) {
+        HuffmanCodes& table = tables[t];
+        table.clear();
+        if(used[t]) buildCodesFromCounts(sums + t * 256, table);
+
+        QByteArray header;
+        table.writeCodeLengths(header);
+        bits += header.size() * 8;
+        for(int c = 0; c < 256; c++) bits += (qint64)sums[t * 256 + c] * table.lengths[c];
+    }
+
+    delete[] sums;
+}
+
+// k-means over the contexts, like picking bzip2's tables: start from the
+// busiest contexts, move every context to the table that codes it in the
+// fewest bits, rebuild the tables, repeat. Unused tables are dropped,
+// returns how many are left
+int HuffmanCompressor::groupContexts(const ContextFrequencyTable& pairs, int tableCount,
+                                     unsigned char* contextMap, HuffmanCodes* tables, qint64& bits) {
+    // contexts that occur, busiest first
+    int active[256];
+    unsigned long long totals[256];
+    int activeCount = 0;
+    for(int p = 0; p < 256; p++) {
+        const FrequencyTable& context = pairs.context((unsigned char)p);
+        contextMap[p] = 0;
+        if(context.size() == 0) continue;
+        unsigned long long total = 0;
+        for(int c = 0; c < 256; c++) total += context.rawCounts()[c];
+
+        int i = activeCount++;
+        while(i > 0 && totals[i - 1] < total) {
+            totals[i] = totals[i - 1];
+            active[i] = active[i - 1];
+            i--;
+        }
+        totals[i] = total;
+        active[i] = p;
+    }
+    if(tableCount > activeCount) tableCount = activeCount;
+    if(tableCount < 1) tableCount = 1;
+
+    for(int t = 0; t < tableCount && t < activeCount; t++) contextMap[active[t]] = (unsigned char)t;
+    for(int t = 0; t < tableCount; t++) {
+        tables[t].clear();
+        if(t < activeCount) buildCodesFromCounts(pairs.rawCounts((unsigned char)active[t]), tables[t]);
+    }
+
+    // the bytes each context has seen, so costing a context only
+    // touches those instead of all 256
+    unsigned char* seen = new unsigned char[activeCount * 256];
+    int seenCount[256];
+    for(int i = 0; i < activeCount && tableCount > 1; i++) {
+        const unsigned long long* counts = pairs.rawCounts((unsigned char)active[i]);
+        seenCount[i] = 0;
+        for(int c = 0; c < 256; c++) {
+            if(counts[c]) seen[i * 256 + seenCount[i]++] = (unsigned char)c;
+        }
+    }
+
+    for(int pass = 0; pass < CLUSTER_PASSES && tableCount > 1; pass++) {
+        for(int i = 0; i < activeCount; i++) {
+            const unsigned long long* counts = pairs.rawCounts((unsigned char)active[i]);
+            const unsigned char* bytes = seen + i * 256;
+            int best = 0;
+            qint64 bestBits = -1;
+            for(int t = 0; t < tableCount; t++) {
+                // a byte the table has no code for is charged like a very long code
+                const unsigned char* lengths = tables[t].lengths;
+                qint64 cost = 0;
+                for(int k = 0; k < seenCount[i]; k++) {
+                    unsigned char c = bytes[k];
+                    cost += (qint64)counts[c] * (lengths[c] ? lengths[c] : MISSING_CODE_COST);
+                }
+                if(bestBits < 0 || cost < bestBits) {
+                    bestBits = cost;
+                    best = t;
+                }
+            }
+            contextMap[active[i]] = (unsigned char)best;
+        }
+
+        // close the gaps left by tables nobody picked
+        int renumber[MAX_CONTEXT_TABLES];
+        bool used[MAX_CONTEXT_TABLES] = {false};
+        for(int i = 0; i < activeCount; i++) used[contextMap[active[i]]] = true;
+        int kept = 0;
+        for(int t = 0; t < tableCount; t++) renumber[t] = used[t] ? kept++ : 0;
+        for(int p = 0; p < 256; p++) contextMap[p] = (unsigned char)renumber[contextMap[p]];
+        tableCount = kept;
+
+        buildContextTables(pairs, contextMap, tableCount, tables, bits);
+    }
+    delete[] seen;
+
+    buildContextTables(pairs, contextMap, tableCount, tables, bits);
+    return tableCount;
+}
+
+// order 1 block: [table count][context map, only with 2+ tables]
+// [code lengths per table][jump table][4 streams]. Every stream starts
+// in context 0, so the four of them decode independently
+bool HuffmanCompressor::writeContextStreams(const unsigned char* data, int size, QByteArray& output) {
+    int part = (size + 3) / 4;
+    int first[4], count[4];
+    for(int s = 0; s < 4; s++) {
+        first[s] = s * part;
+        count[s] = (s == 3) ? size - first[s] : part;
+        if(first[s] > size) first[s] = size;
+        if(count[s] > size - first[s]) count[s] = size - first[s];
+        if(count[s] < 0) count[s] = 0;
+    }
+
+    ContextFrequencyTable pairs;
+    for(int s = 0; s < 4; s++) pairs.addBytes(data + first[s], count[s], 0);
+
+    // more tables fit the contexts better but cost header, try 1, 2, 4 ..
+    // until it stops paying off
+    HuffmanCodes tables[MAX_CONTEXT_TABLES];
+    unsigned char contextMap[256];
+    unsigned char bestMap[256];
+    int bestCount = 0;
+    qint64 bestBits = -1;
+    for(int k = 1; k <= MAX_CONTEXT_TABLES; k *= 2) {
+        qint64 bits = 0;
+        int kept = groupContexts(pairs, k, contextMap, tables, bits);
+        if(bestBits >= 0 && bits >= bestBits) break;
+        bestBits = bits;
+        bestCount = kept;
+        memcpy(bestMap, contextMap, sizeof(bestMap));
+        if(kept < k) break;   // ran out of contexts
+    }
+    qint64 bits = 0;
+    buildContextTables(pairs, bestMap, bestCount, tables, bits);
+
+    output.append((char)bestCount);
+    if(bestCount > 1) output.append((const char*)bestMap, 256);
+    for(int t = 0; t < bestCount; t++) tables[t].writeCodeLengths(output);
+
+    const CodeTable* contextCodes[256];
+    for(int p = 0; p < 256; p++) contextCodes[p] = &tables[bestMap[p]].table;
+
+    int jumpTable = output.size();
+    for(int i = 0; i < 12; i++) output.append((char)0);
+
+    bool ok = true;
+    for(int s = 0; s < 4 && ok; s++) {
+        const unsigned char* src = data + first[s];
+
+        qint64 totalBits = 0;
+        unsigned char prev = 0;
+        for(int i = 0; i < count[s]; i++) {
+            totalBits += contextCodes[prev]->getLength(src[i]);
+            prev = src[i];
+        }
+
+        int start = output.size();
+        qint64 dataBytes = (totalBits + 7) / 8;
+        if(start + 1 + dataBytes + 8 > 0x7FFFFFFF) {
+            ok = false;
+            break;
+        }
+        output.append((char)((8 - totalBits % 8) % 8));   // padding
+        int dataStart = output.size();
+        output.resize(dataStart + (int)dataBytes + 8);
+        BitWriter writer((unsigned char*)output.data() + dataStart);
+        prev = 0;
+        for(int i = 0; i < count[s]; i++) {
+            const CodeTable* code = contextCodes[prev];
+            writer.write(code->getCode(src[i]), code->getLength(src[i]));
+            prev = src[i];
+        }
+        writer.flush();
+        output.resize(dataStart + (int)dataBytes);
+
+        if(s < 3) {
+            int streamSize = output.size() - start;
+            for(int i = 0; i < 4; i++) {
+                output[jumpTable + s * 4 + i] = (char)((streamSize >> (i * 8)) & 0xFF);
+            }
+        }
+    }
+
+    return ok;
+}
+
+bool HuffmanCompressor::decodeContextStreams(const unsigned char* data, int size, char* out, qint64 count) {
+    QByteArray block = QByteArray::fromRawData((const char*)data, size);
+    if(size < 1) return false;
+    int tableCount = data[0];
+    int pos = 1;
+    if(tableCount < 1 || tableCount > MAX_CONTEXT_TABLES) return false;
+
+    unsigned char contextMap[256];
+    if(tableCount > 1) {
+        if(size - pos < 256) return false;
+        for(int p = 0; p < 256; p++) {
+            contextMap[p] = data[pos + p];
+            if(contextMap[p] >= tableCount) return false;
+        }
+        pos += 256;
+    } else {
+        memset(contextMap, 0, sizeof(contextMap));
+    }
+
+    HuffmanCodes tables[MAX_CONTEXT_TABLES];
+    bool ok = true;
+    for(int t = 0; t < tableCount && ok; t++) {
+        ok = tables[t].readCodeLengths(block, pos) && tables[t].buildDecodeTable();
+    }
+
+    // per context straight to its lookup table
+    const DecodeEntry* contextTable[256];
+    int contextBits[256];
+    if(ok) {
+        for(int p = 0; p < 256; p++) {
+            contextTable[p] = &tables[contextMap[p]].decodeTable[0];
+            contextBits[p] = tables[contextMap[p]].primaryBits;
+        }
+    }
+
+    // where each stream starts and how long it is
+    const unsigned char* streamData[4];
+    int streamSize[4];
+    if(ok && size - pos < 12) ok = false;
+    if(ok) {
+        const unsigned char* jump = data + pos;
+        pos += 12;
+        for(int s = 0; s < 3 && ok; s++) {
+            int len = 0;
+            for(int i = 0; i < 4; i++) len |= (int)jump[s * 4 + i] << (i * 8);
+            if(len < 1 || len > size - pos) ok = false;
+            streamData[s] = data + pos;
+            streamSize[s] = len;
+            pos += len;
+        }
+        if(pos >= size) ok = false;
+        streamData[3] = data + pos;
+        streamSize[3] = size - pos;
+    }
+    if(!ok) return false;
+
+    qint64 part = (count + 3) / 4;
+    char* streamOut[4];
+    qint64 streamCount[4];
+    qint64 totalBits[4];
+    for(int s = 0; s < 4; s++) {
+        qint64 first = s * part;
+        qint64 len = (s == 3) ? count - first : part;
+        if(first > count) first = count;
+        if(len > count - first) len = count - first;
+        if(len < 0) len = 0;
+        streamOut[s] = out + first;
+        streamCount[s] = len;
+
+        // every symbol takes at least one bit
+        totalBits[s] = (qint64)(streamSize[s] - 1) * 8 - streamData[s][0];
+        if(streamCount[s] > totalBits[s]) ok = false;
+    }
+    if(!ok) return false;
+
+    BitReader r0(streamData[0] + 1, streamSize[0] - 1);
+    BitReader r1(streamData[1] + 1, streamSize[1] - 1);
+    BitReader r2(streamData[2] + 1, streamSize[2] - 1);
+    BitReader r3(streamData[3] + 1, streamSize[3] - 1);
+    int p0 = 0, p1 = 0, p2 = 0, p3 = 0;
+
+    // same as decodeStreams, only the table follows each stream's last byte
+    qint64 common = streamCount[3];
+    qint64 i = 0;
+    while(i < common && ok) {
+        r0.refill();
+        r1.refill();
+        r2.refill();
+        r3.refill();
+
+        qint64 stop = i + 4;
+        if(stop > common) stop = common;
+        for(; i < stop; i++) {
+            int c0 = decodeSymbol(r0, contextTable[p0], contextBits[p0]);
+            int c1 = decodeSymbol(r1, contextTable[p1], contextBits[p1]);
+            int c2 = decodeSymbol(r2, contextTable[p2], contextBits[p2]);
+            int c3 = decodeSymbol(r3, contextTable[p3], contextBits[p3]);
+            if((c0 | c1 | c2 | c3) < 0) {
+                ok = false;
+                break;
+            }
+
+            streamOut[0][i] = (char)c0;
+            streamOut[1][i] = (char)c1;
+            streamOut[2][i] = (char)c2;
+            streamOut[3][i] = (char)c3;
+            p0 = c0;
+            p1 = c1;
+            p2 = c2;
+            p3 = c3;
+        }
+    }
+    if(ok && r3.position() > totalBits[3]) ok = false;
+
+    // leftovers of the first three streams
+    for(int s = 0; s < 3 && ok; s++) {
+        BitReader reader = (s == 0) ? r0 : (s == 1) ? r1 : r2;
+        int prev = (s == 0) ? p0 : (s == 1) ? p1 : p2;
+        for(qint64 k = common; k < streamCount[s]; k++) {
+            reader.refill();
+            int c = decodeSymbol(reader, contextTable[prev], contextBits[prev]);
+            if(c < 0) {
+                ok = false;
+                break;
+            }
+            streamOut[s][k] = (char)c;
+            prev = c;
+        }
+
+        // decoding into the padding means the data was cut short
+        if(reader.position() > totalBits[s]) ok = false;
+    }
+
+    return ok;
+}
+
+// compresses or expands one block on a pool thread
+// every task gets its own compressor so no tables are shared
+class HuffmanBlockTask : public QRunnable {
+public:
+    const unsigned char* src;
+    int srcSize;
+    QByteArray* packed;   // compress: where the block goes
+    char* dst;            // decompress: slice of the output
+    int dstSize;
+    bool decode;
+    bool fourStreams;
+    bool order1;
+    bool rans;
+    int maxCodeLength;
+    bool* ok;
+
+    void run() override {
+        HuffmanCompressor worker;
+        worker.setMaxCodeLength(maxCodeLength);
+
+        if(rans) {
+            RANSCoder coder;
+            if(!decode) {
+                worker.buildFrequencyTable(src, srcSize);
+                *ok = coder.buildFromCounts(worker.freqTable.rawCounts());
+                if(*ok) {
+                    coder.writeTable(*packed);
+                    *ok = coder.encode(src, srcSize, *packed);
+                }
+                return;
+            }
+
+            QByteArray block = QByteArray::fromRawData((const char*)src, srcSize);
+            int pos = 0;
+            *ok = coder.readTable(block, pos) &&
+                  coder.decode(src + pos, srcSize - pos, (unsigned char*)dst, dstSize);
+            return;
+        }
+
+        if(order1) {
+            *ok = decode ? worker.decodeContextStreams(src, srcSize, dst, dstSize)
+                         : worker.writeContextStreams(src, srcSize, *packed);
+            return;
+        }
+
+        if(!decode) {
+            *ok = worker.buildCodes(src, srcSize);
+            if(*ok) {
+                worker.codes.writeCodeLengths(*packed);
+                *ok = fourStreams ? worker.writeStreams(src, srcSize, *packed)
+                                  : worker.writeBits(src, srcSize, *packed);
+            }
+            return;
+        }
+
+        QByteArray block = QByteArray::fromRawData((const char*)src, srcSize);
+        int pos = 0;
+        if(!worker.readCodeLengths(block, pos)) {
+            *ok = false;
+            return;
+        }
+        *ok = fourStreams ? worker.decodeStreams(src + pos, srcSize - pos, dst, dstSize)
+                          : worker.decodeBits(src + pos, srcSize - pos, dst, dstSize);
+    }
+};
+
+void HuffmanCompressor::setBlockSize(int bytes) {
+    if(bytes < 0) bytes = 0;
+    blockSize = bytes;
+}
+
+void HuffmanCompressor::setFourStreams(bool enabled) {
+    fourStreams = enabled;
+}
+
+void HuffmanCompressor::setContextModel(bool enabled) {
+    contextModel = enabled;
+}
+
+void HuffmanCompressor::setRansCoding(bool enabled) {
+    ransCoding = enabled;
+}
+
+void HuffmanCompressor::setThreadCount(int threads) {
+    if(threads < 1) threads = 1;
+    threadCount = threads;
+}
+
+QByteArray HuffmanCompressor::compress(const QByteArray& input) {
+    if(input.isEmpty()) return QByteArray();
+
+    if(blockSize > 0 || fourStreams || contextModel || ransCoding) return compressBlocks(input);
+
+    const unsigned char* src = (const unsigned char*)input.constData();
+    if(!buildCodes(src, input.size())) return QByteArray();
 
     QByteArray result;
 
@@ -140,43 +1074,123 @@ QByteArray HuffmanCompressor::compress(const QByteArray& input) {
         result.append((char)((origSize >> (i * 8)) & 0xFF));
     }
 
-    // serialize tree
-    QByteArray treeData;
-    serializeTreeBinary(root, treeData);
+    // code lengths are all the decoder needs to rebuild the codes
+    QByteArray header;
+    codes.writeCodeLengths(header);
 
-    // write tree size (4 bytes)
-    int treeSize = treeData.size();
-    result.append((char)(treeSize & 0xFF));
-    result.append((char)((treeSize >> 8) & 0xFF));
-    result.append((char)((treeSize >> 16) & 0xFF));
-    result.append((char)((treeSize >> 24) & 0xFF));
+    // write header size (4 bytes)
+    int headerSize = header.size();
+    result.append((char)(headerSize & 0xFF));
+    result.append((char)((headerSize >> 8) & 0xFF));
+    result.append((char)((headerSize >> 16) & 0xFF));
+    result.append((char)((headerSize >> 24) & 0xFF));
 
-    result.append(treeData);
+    result.append(header);
 
-    // calculate padding
-    int padding = (8 - (bitString.length() % 8)) % 8;
-    result.append((char)padding);
-
-    // convert bit string to bytes
-    for(int i = 0; i < bitString.length(); i += 8) {
-        unsigned char byte = 0;
-        for(int j = 0; j < 8 && (i + j) < bitString.length(); j++) {
-            if(bitString[i + j] == '1') {
-                byte |= (1 << (7 - j));
-            }
+    if(!writeBits(src, input.size(), result)) return QByteArray();
+
+    return result;
+}
+
+// block layout:
+//   FF FF FF FF            marker, can't be the start of a classic file
+//   1 byte                 flags (BLOCK_FOUR_STREAMS, BLOCK_ORDER1, BLOCK_RANS)
+//   8 bytes                original size
+//   4 bytes                block size
+//   4 bytes                block count
+//   4 bytes per block      compressed size of each block
+//   blocks                 [code lengths][padding][bits], one after another
+//                          or [code lengths][jump table][4 streams]
+//                          or order 1, see writeContextStreams
+//                          or [rANS table][rANS states and bytes]
+QByteArray HuffmanCompressor::compressBlocks(const QByteArray& input) {
+    // four streams, order 1 or rANS without blocks is just one big block
+    int perBlock = blockSize > 0 ? blockSize : input.size();
+    int blockCount = (int)(((qint64)input.size() + perBlock - 1) / perBlock);
+
+    QByteArray* packed = new QByteArray[blockCount];
+    bool* ok = new bool[blockCount];
+
+    // every block gets its own histogram and codes, so they run side by side
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+
+    const unsigned char* src = (const unsigned char*)input.constData();
+    for(int b = 0; b < blockCount; b++) {
+        HuffmanBlockTask* task = new HuffmanBlockTask();
+        task->src = src + (qint64)b * perBlock;
+        task->srcSize = (b == blockCount - 1) ? input.size() - b * perBlock : perBlock;
+        task->packed = &packed[b];
+        task->dst = nullptr;
+        task->dstSize = 0;
+        task->decode = false;
+        task->fourStreams = fourStreams;
+        task->order1 = contextModel && !ransCoding;
+        task->rans = ransCoding;
+        task->maxCodeLength = maxCodeLength;
+        task->ok = &ok[b];
+        pool.start(task);
+    }
+    pool.waitForDone();
+
+    QByteArray result;
+    qint64 total = 0;
+    bool allOk = true;
+    for(int b = 0; b < blockCount; b++) {
+        if(!ok[b]) allOk = false;
+        total += packed[b].size();
+    }
+
+    if(allOk && total + 21 + 4LL * blockCount <= 0x7FFFFFFF) {
+        result.reserve((int)(total + 21 + 4LL * blockCount));
+
+        // marker
+        for(int i = 0; i < 4; i++) result.append((char)0xFF);
+        unsigned char flags = ransCoding ? BLOCK_RANS
+                            : contextModel ? BLOCK_ORDER1
+                            : fourStreams ? BLOCK_FOUR_STREAMS : 0;
+        result.append((char)flags);
+
+        qint64 origSize = input.size();
+        for(int i = 0; i < 8; i++) {
+            result.append((char)((origSize >> (i * 8)) & 0xFF));
+        }
+        for(int i = 0; i < 4; i++) result.append((char)((perBlock >> (i * 8)) & 0xFF));
+        for(int i = 0; i < 4; i++) result.append((char)((blockCount >> (i * 8)) & 0xFF));
+
+        // block size table
+        for(int b = 0; b < blockCount; b++) {
+            int size = packed[b].size();
+            for(int i = 0; i < 4; i++) result.append((char)((size >> (i * 8)) & 0xFF));
+        }
+
+        for(int b = 0; b < blockCount; b++) {
+            result.append(packed[b]);
         }
-        result.append((char)byte);
     }
 
+    delete[] packed;
+    delete[] ok;
     return result;
 }
 
 QByteArray HuffmanCompressor::decompress(const QByteArray& input) {
     if(input.size() < 13) return QByteArray();
 
-    if(root) {
-        deleteTree(root);
-        root = nullptr;
+    // block and adaptive layouts start with a marker the classic one can't have
+    if((unsigned char)input[0] == 0xFF &&
+        (unsigned char)input[1] == 0xFF &&
+        (unsigned char)input[2] == 0xFF &&
+        (unsigned char)input[3] == 0xFF) {
+        if((unsigned char)input[4] != ADAPTIVE_STREAM) return decompressBlocks(input);
+
+        QBuffer source;
+        source.setData(input);
+        source.open(QIODevice::ReadOnly);
+        QBuffer target;
+        target.open(QIODevice::WriteOnly);
+        if(!decompressAdaptive(&source, &target)) return QByteArray();
+        return target.data();
     }
 
     int pos = 0;
@@ -187,76 +1201,424 @@ QByteArray HuffmanCompressor::decompress(const QByteArray& input) {
         origSize |= ((qint64)(unsigned char)input[pos++]) << (i * 8);
     }
 
-    // read tree size (4 bytes)
-    int treeSize = ((unsigned char)input[pos]) |
-                   ((unsigned char)input[pos+1] << 8) |
-                   ((unsigned char)input[pos+2] << 16) |
-                   ((unsigned char)input[pos+3] << 24);
+    // read header size (4 bytes)
+    int headerSize = ((unsigned char)input[pos]) |
+                     ((unsigned char)input[pos+1] << 8) |
+                     ((unsigned char)input[pos+2] << 16) |
+                     ((unsigned char)input[pos+3] << 24);
     pos += 4;
 
-    if(pos + treeSize >= input.size()) return QByteArray();
+    if(headerSize <= 0 || headerSize >= input.size() - pos) return QByteArray();
 
-    // read and rebuild tree
-    QByteArray treeData = input.mid(pos, treeSize);
-    pos += treeSize;
+    // read code lengths, they have to fill the header exactly
+    int headerEnd = pos + headerSize;
+    if(!readCodeLengths(input, pos) || pos != headerEnd) return QByteArray();
 
-    int treePos = 0;
-    root = deserializeTreeBinary(treeData, treePos);
+    if(origSize <= 0 || origSize > 0x7FFFFFFF) return QByteArray();
 
-    if(!root) return QByteArray();
+    // unless it's one repeated character every symbol needs a bit, that
+    // one is stored as the padding byte alone
+    unsigned char onlyChar = 0;
+    int distinct = codes.countCodes(onlyChar);
+    qint64 dataBytes = input.size() - pos;
+    if(distinct > 1 && origSize > dataBytes * 8) return QByteArray();
+    if(distinct == 1 && dataBytes != 1) return QByteArray();
 
-    // handle single character case
-    if(root->isLeaf()) {
-        QByteArray result;
-        for(qint64 i = 0; i < origSize; i++) {
-            result.append((char)root->character);
-        }
-        return result;
+    QByteArray result;
+    result.resize((int)origSize);
+
+    const unsigned char* data = (const unsigned char*)input.constData() + pos;
+    if(!decodeBits(data, input.size() - pos, result.data(), origSize)) {
+        return QByteArray();
     }
 
-    // read padding
-    if(pos >= input.size()) return QByteArray();
-    int padding = (unsigned char)input[pos];
-    pos++;
+    return result;
+}
+
+QByteArray HuffmanCompressor::decompressBlocks(const QByteArray& input) {
+    const unsigned char* data = (const unsigned char*)input.constData();
+    if(input.size() < 21) return QByteArray();
+    unsigned char flags = data[4];
+    if(flags & ~(BLOCK_FOUR_STREAMS | BLOCK_ORDER1 | BLOCK_RANS)) return QByteArray();  // from a newer version
+    int pos = 5;
+
+    qint64 origSize = 0;
+    for(int i = 0; i < 8; i++) {
+        origSize |= ((qint64)data[pos++]) << (i * 8);
+    }
+    int size = 0, count = 0;
+    for(int i = 0; i < 4; i++) size |= (int)data[pos++] << (i * 8);
+    for(int i = 0; i < 4; i++) count |= (int)data[pos++] << (i * 8);
+
+    if(origSize <= 0 || origSize > 0x7FFFFFFF || size <= 0 || count <= 0) return QByteArray();
+    if((origSize + size - 1) / size != count) return QByteArray();
+    if((qint64)count * 4 > input.size() - pos) return QByteArray();
+
+    // compressed blocks have to add up to the rest of the file
+    int tableStart = pos;
+    qint64 total = 0;
+    for(int b = 0; b < count; b++) {
+        int packedSize = 0;
+        for(int i = 0; i < 4; i++) packedSize |= (int)data[pos++] << (i * 8);
+        if(packedSize <= 0) return QByteArray();
+        total += packedSize;
+    }
+    if(pos + total != input.size()) return QByteArray();
+
+    // and each one has to be able to hold its share of origSize
+    int blockPos = pos;
+    for(int b = 0; b < count; b++) {
+        int packedSize = 0;
+        for(int i = 0; i < 4; i++) packedSize |= (int)data[tableStart + b * 4 + i] << (i * 8);
+        qint64 blockBytes = (b == count - 1) ? origSize - (qint64)b * size : size;
+        if(blockBytes > blockOutputLimit(data + blockPos, packedSize, flags)) return QByteArray();
+        blockPos += packedSize;
+    }
 
-    // decode bit by bit
     QByteArray result;
-    HuffmanNode* current = root;
+    result.resize((int)origSize);
+
+    bool* ok = new bool[count];
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+
+    blockPos = pos;
+    for(int b = 0; b < count; b++) {
+        int packedSize = 0;
+        for(int i = 0; i < 4; i++) packedSize |= (int)data[tableStart + b * 4 + i] << (i * 8);
 
-    for(int i = pos; i < input.size(); i++) {
-        unsigned char byte = (unsigned char)input[i];
-        int bitsToRead = 8;
+        HuffmanBlockTask* task = new HuffmanBlockTask();
+        task->src = data + blockPos;
+        task->srcSize = packedSize;
+        task->packed = nullptr;
+        task->dst = result.data() + (qint64)b * size;
+        task->dstSize = (b == count - 1) ? (int)(origSize - (qint64)b * size) : size;
+        task->decode = true;
+        task->fourStreams = (flags & BLOCK_FOUR_STREAMS) != 0;
+        task->order1 = (flags & BLOCK_ORDER1) != 0;
+        task->rans = (flags & BLOCK_RANS) != 0;
+        task->maxCodeLength = maxCodeLength;
+        task->ok = &ok[b];
+        pool.start(task);
 
-        if(i == input.size() - 1) {
-            bitsToRead = 8 - padding;
+        blockPos += packedSize;
+    }
+    pool.waitForDone();
+
+    bool allOk = true;
+    for(int b = 0; b < count; b++) {
+        if(!ok[b]) allOk = false;
+    }
+    delete[] ok;
+
+    if(!allOk) return QByteArray();
+    return result;
+}
+
+// most bytes a packed block can decode to, checked before anything is
+// allocated. A huffman code is at least a bit and a rANS symbol costs
+// more than 1 / TOTAL of a bit, only a table with a single symbol codes
+// it in no bits at all. 0 if the tables are broken
+qint64 HuffmanCompressor::blockOutputLimit(const unsigned char* src, int size, unsigned char flags) {
+    QByteArray block = QByteArray::fromRawData((const char*)src, size);
+    int pos = 0;
+    unsigned char onlyChar = 0;
+
+    if(flags & BLOCK_RANS) {
+        RANSCoder coder;
+        if(!coder.readTable(block, pos)) return 0;
+        for(int c = 0; c < 256; c++) {
+            if(coder.symbolFreq(c) == RANSCoder::TOTAL) return 0x7FFFFFFF;
         }
+        return (qint64)(size - pos) * 8 * RANSCoder::TOTAL;
+    }
 
-        for(int j = 7; j >= (8 - bitsToRead); j--) {
-            if(!current) {
-                current = root;
-            }
+    HuffmanCodes codes;
+    int tableCount = 1;
+    if(flags & BLOCK_ORDER1) {
+        if(size < 1) return 0;
+        tableCount = src[0];
+        if(tableCount < 1 || tableCount > MAX_CONTEXT_TABLES) return 0;
+        pos = (tableCount > 1) ? 1 + 256 : 1;   // skip the context map
+    }
+    for(int t = 0; t < tableCount; t++) {
+        if(!codes.readCodeLengths(block, pos)) return 0;
+        if(codes.countCodes(onlyChar) == 1) return 0x7FFFFFFF;
+    }
+    return (qint64)(size - pos) * 8;
+}
 
-            if(byte & (1 << j)) {
-                if(current->right) {
-                    current = current->right;
-                }
-            } else {
-                if(current->left) {
-                    current = current->left;
-                }
+// adaptive model: every character starts with a count of one, and the
+// codes are rebuilt from the counts seen so far. Encoder and decoder do
+// this at the same symbol positions so no code table is ever stored
+void HuffmanCompressor::rebuildAdaptiveCodes(unsigned long long* counts) {
+    // halve old counts now and then so the model follows the data
+    unsigned long long total = 0;
+    for(int c = 0; c < 256; c++) total += counts[c];
+    if(total > ADAPTIVE_MAX_TOTAL) {
+        for(int c = 0; c < 256; c++) counts[c] = (counts[c] + 1) / 2;
+    }
+
+    freqTable = FrequencyTable();
+    for(int c = 0; c < 256; c++) {
+        freqTable.insert((unsigned char)c, counts[c]);
+    }
+    buildCodesFromTable(ADAPTIVE_CODE_LENGTH, codes);
+}
+
+static void writeInt32(char* dst, int value) {
+    for(int i = 0; i < 4; i++) dst[i] = (char)((value >> (i * 8)) & 0xFF);
+}
+
+static int readInt32(const char* src) {
+    int value = 0;
+    for(int i = 0; i < 4; i++) value |= (int)(unsigned char)src[i] << (i * 8);
+    return value;
+}
+
+// keep reading until size bytes came in, pipes may hand out less per call
+static bool readFully(QIODevice* in, char* dst, qint64 size) {
+    while(size > 0) {
+        qint64 got = in->read(dst, size);
+        if(got <= 0) return false;
+        dst += got;
+        size -= got;
+    }
+    return true;
+}
+
+// adaptive layout:
+//   FF FF FF FF 80         marker and ADAPTIVE_STREAM flag
+//   frames                 [symbol count 4][coded size 4][bits]
+//   end                    frame with a symbol count of 0
+// one frame per chunk read from the input, the model runs on across frames
+bool HuffmanCompressor::compressAdaptive(QIODevice* in, QIODevice* out) {
+    unsigned long long counts[256];
+    for(int c = 0; c < 256; c++) counts[c] = 1;
+    rebuildAdaptiveCodes(counts);
+
+    int interval = ADAPTIVE_FIRST_REBUILD;
+    int untilRebuild = interval;
+
+    char marker[5] = { (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)ADAPTIVE_STREAM };
+    if(out->write(marker, 5) != 5) return false;
+
+    QByteArray chunk;
+    chunk.resize(ADAPTIVE_CHUNK);
+    QByteArray packed;
+    packed.resize(8 + ADAPTIVE_CHUNK * ADAPTIVE_CODE_LENGTH / 8 + 16);
+
+    while(true) {
+        qint64 got = in->read(chunk.data(), ADAPTIVE_CHUNK);
+        if(got < 0) return false;
+        if(got == 0) break;
+
+        const unsigned char* src = (const unsigned char*)chunk.constData();
+        BitWriter writer((unsigned char*)packed.data() + 8);
+
+        for(int i = 0; i < got; i++) {
+            unsigned char c = src[i];
+            writer.write(codes.table.getCode(c), codes.table.getLength(c));
+            counts[c]++;
+
+            if(--untilRebuild == 0) {
+                rebuildAdaptiveCodes(counts);
+                if(interval < ADAPTIVE_MAX_INTERVAL) interval *= 2;
+                untilRebuild = interval;
             }
+        }
+        writer.flush();
 
-            if(current && current->isLeaf()) {
-                result.append((char)current->character);
+        int size = (int)writer.bytesWritten();
+        writeInt32(packed.data(), (int)got);
+        writeInt32(packed.data() + 4, size);
+        if(out->write(packed.constData(), 8 + size) != 8 + size) return false;
+    }
 
-                if(result.size() >= origSize) {
-                    return result;
-                }
+    char end[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    return out->write(end, 8) == 8;
+}
+
+bool HuffmanCompressor::decompressAdaptive(QIODevice* in, QIODevice* out) {
+    char marker[5];
+    if(!readFully(in, marker, 5)) return false;
+    for(int i = 0; i < 4; i++) {
+        if((unsigned char)marker[i] != 0xFF) return false;
+    }
+    if((unsigned char)marker[4] != ADAPTIVE_STREAM) return false;
+
+    unsigned long long counts[256];
+    for(int c = 0; c < 256; c++) counts[c] = 1;
+    rebuildAdaptiveCodes(counts);
+    if(!codes.buildDecodeTable()) return false;
+
+    int interval = ADAPTIVE_FIRST_REBUILD;
+    int untilRebuild = interval;
+
+    int maxPacked = ADAPTIVE_CHUNK * ADAPTIVE_CODE_LENGTH / 8 + 8;
+    QByteArray packed;
+    packed.resize(maxPacked);
+    QByteArray chunk;
+    chunk.resize(ADAPTIVE_CHUNK);
+
+    while(true) {
+        char frame[8];
+        if(!readFully(in, frame, 8)) return false;
+        int count = readInt32(frame);
+        int size = readInt32(frame + 4);
+
+        if(count == 0) return size == 0;
+        if(count < 0 || count > ADAPTIVE_CHUNK || size < 0 || size > maxPacked) return false;
+        if(!readFully(in, packed.data(), size)) return false;
+
+        BitReader reader((const unsigned char*)packed.constData(), size);
+        char* dst = chunk.data();
+        int produced = 0;
+
+        while(produced < count) {
+            // decode up to the next point where the codes change
+            int run = count - produced;
+            if(run > untilRebuild) run = untilRebuild;
 
-                current = root;
+            const DecodeEntry* table = &codes.decodeTable[0];
+            for(int k = 0; k < run; k++) {
+                reader.refill();
+                int c = decodeSymbol(reader, table, codes.primaryBits);
+                if(c < 0) return false;
+                dst[produced++] = (char)c;
+                counts[c]++;
+            }
+
+            untilRebuild -= run;
+            if(untilRebuild == 0) {
+                rebuildAdaptiveCodes(counts);
+                if(!codes.buildDecodeTable()) return false;
+                if(interval < ADAPTIVE_MAX_INTERVAL) interval *= 2;
+                untilRebuild = interval;
             }
         }
+
+        if(reader.position() > (qint64)size * 8) return false;
+        if(out->write(chunk.constData(), count) != count) return false;
+    }
+}
+
+// counts from all samples, plus one for every character so the table
+// can still code bytes the samples never had
+QByteArray HuffmanCompressor::trainPreset(DynamicArray<QByteArray>& samples) {
+    freqTable = FrequencyTable();
+    for(int i = 0; i < samples.size(); i++) {
+        freqTable.addBytes((const unsigned char*)samples[i].constData(), samples[i].size());
+    }
+    for(int c = 0; c < 256; c++) {
+        unsigned long long* freq = freqTable.get((unsigned char)c);
+        freqTable.insert((unsigned char)c, (freq ? *freq : 0) + 1);
+    }
+
+    buildCodesFromTable(PRESET_CODE_LENGTH, codes);
+    return QByteArray((const char*)codes.lengths, 256);
+}
+
+// put a preset's codes in place, kept until some other codes replace them
+bool HuffmanCompressor::loadPreset(int presetId) {
+    if(presetId == loadedPreset) return true;
+
+    const HuffmanPreset* preset = findHuffmanPreset(presetId);
+    if(!preset) return false;
+
+    for(int c = 0; c < 256; c++) codes.lengths[c] = preset->lengths[c];
+    if(!codes.buildDecodeTable()) return false;  // also builds the canonical codes
+
+    loadedPreset = presetId;
+    return true;
+}
+
+// LEB128: 7 bits per byte, high bit set when more bytes follow
+static void writeVarint(QByteArray& output, qint64 value) {
+    while(value >= 0x80) {
+        output.append((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    output.append((char)value);
+}
+
+static bool readVarint(const QByteArray& data, int& pos, qint64& value) {
+    value = 0;
+    for(int shift = 0; shift < 63; shift += 7) {
+        if(pos >= data.size()) return false;
+        unsigned char byte = (unsigned char)data[pos++];
+        value |= (qint64)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// preset layout:
+//   1 byte                 preset id
+//   varint                 original size
+//   bits                   codes, last byte padded with zeros
+QByteArray HuffmanCompressor::compressWithPreset(const QByteArray& input, int presetId) {
+    if(input.isEmpty() || !loadPreset(presetId)) return QByteArray();
+
+    const unsigned char* src = (const unsigned char*)input.constData();
+
+    QByteArray result;
+    result.append((char)presetId);
+    writeVarint(result, input.size());
+
+    if(!appendCodes(src, input.size(), countBits(src, input.size()), result)) {
+        return QByteArray();
     }
+    return result;
+}
+
+QByteArray HuffmanCompressor::decompressWithPreset(const QByteArray& input) {
+    if(input.size() < 2) return QByteArray();
+
+    int pos = 0;
+    int presetId = (unsigned char)input[pos++];
+    qint64 origSize = 0;
+    if(!readVarint(input, pos, origSize)) return QByteArray();
+
+    // every code is at least one bit
+    qint64 totalBits = (qint64)(input.size() - pos) * 8;
+    if(origSize <= 0 || origSize > totalBits || origSize > 0x7FFFFFFF) return QByteArray();
+
+    if(!loadPreset(presetId)) return QByteArray();
+
+    QByteArray result;
+    result.resize((int)origSize);
 
+    const unsigned char* data = (const unsigned char*)input.constData() + pos;
+    if(!decodeCodes(data, input.size() - pos, totalBits, result.data(), origSize)) {
+        return QByteArray();
+    }
     return result;
 }
+
+bool HuffmanCompressor::buildCodesFromCounts(const unsigned long long* counts) {
+    return buildCodesFromCounts(counts, codes);
+}
+
+bool HuffmanCompressor::buildCodesFromCounts(const unsigned long long* counts, HuffmanCodes& target) {
+    freqTable = FrequencyTable();
+    for(int c = 0; c < 256; c++) {
+        freqTable.insert((unsigned char)c, counts[c]);
+    }
+    return buildCodesFromTable(maxCodeLength, target);
+}
+
+void HuffmanCompressor::writeCodeTable(QByteArray& output) {
+    codes.writeCodeLengths(output);
+}
+
+bool HuffmanCompressor::readCodeTable(const QByteArray& data, int& pos) {
+    if(!readCodeLengths(data, pos)) return false;
+    return codes.buildDecodeTable();
+}
+
+int HuffmanCodes::readSymbol(BitReader& reader) const {
+    reader.refill();
+    return decodeSymbol(reader, &decodeTable[0], primaryBits);
+}
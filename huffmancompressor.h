@@ -3,45 +3,229 @@
 
 #include <QString>
 #include <QByteArray>
+#include <QIODevice>
 #include "datastructures.h"
 
 // Node for huffman tree
+// nodes live in one array, children are indices into it
 struct HuffmanNode {
+    static const unsigned short NO_CHILD = 0xFFFF;
+
     unsigned char character;
     unsigned long long frequency;
-    HuffmanNode *left, *right;
+    unsigned short left, right;
 
-    HuffmanNode() : character(0), frequency(0), left(nullptr), right(nullptr) {}
+    HuffmanNode() : character(0), frequency(0), left(NO_CHILD), right(NO_CHILD) {}
 
     HuffmanNode(unsigned char ch, unsigned long long freq)
-        : character(ch), frequency(freq), left(nullptr), right(nullptr) {}
+        : character(ch), frequency(freq), left(NO_CHILD), right(NO_CHILD) {}
 
     bool isLeaf() const {
-        return (left == nullptr && right == nullptr);
+        return (left == NO_CHILD && right == NO_CHILD);
+    }
+};
+
+// One slot of the decode lookup table
+// length > 0 means the slot resolves a symbol using that many bits,
+// otherwise it links to a sub table at index value with subBits index bits
+struct DecodeEntry {
+    unsigned int value;      // decoded character or sub table start
+    unsigned char length;    // bits consumed, 0 for a link / invalid slot
+    unsigned char subBits;   // width of linked sub table (0 = invalid code)
+
+    DecodeEntry() : value(0), length(0), subBits(0) {}
+};
+
+// One canonical code: the 256 code lengths, the codes made from them
+// and the decode lookup table. Small enough to keep a few dozen on the
+// stack, e.g. the tables of an order 1 block
+class HuffmanCodes {
+public:
+    static const int PRIMARY_TABLE_BITS = 11;  // bits resolved by first lookup
+    static const int SUB_TABLE_BITS = 8;       // max bits per sub table lookup
+    static const int MAX_CODE_LENGTH = 56;     // longest code the bit writer takes
+
+    unsigned char lengths[256];   // canonical code length per character
+    CodeTable table;
+
+    // lookup tables for decoding, primary table sits at index 0
+    DynamicArray<DecodeEntry> decodeTable;
+    int primaryBits;
+
+private:
+    int allocTable(int bits);
+    void fillDecodeTable(const unsigned char* symbols, int first, int last,
+                         int consumed, int tableStart, int tableBits);
+
+public:
+    HuffmanCodes();
+
+    // the decode table can't be shared
+    HuffmanCodes(const HuffmanCodes&) = delete;
+    HuffmanCodes& operator=(const HuffmanCodes&) = delete;
+
+    void clear();   // no codes at all
+
+    // squeeze lengths so none is longer than maxLength
+    void limitCodeLengths(int maxLength);
+
+    // canonical codes, only the lengths are stored in the file
+    void buildCanonicalCodes();
+    void writeCodeLengths(QByteArray& output) const;
+    bool readCodeLengths(const QByteArray& data, int& pos);
+
+    // table driven decoding built from the lengths, also builds the
+    // codes. False if the lengths can't be a prefix code
+    bool buildDecodeTable();
+
+    // how many characters have a code, onlyChar gets the last one seen
+    int countCodes(unsigned char& onlyChar) const;
+
+    void writeSymbol(BitWriter& writer, int symbol) const {
+        writer.write(table.getCode((unsigned char)symbol), table.getLength((unsigned char)symbol));
     }
+    int readSymbol(BitReader& reader) const;  // -1 for an invalid code
 };
 
 class HuffmanCompressor {
+    friend class HuffmanBlockTask;
+
 private:
-    HuffmanNode* root;
+    static const int MAX_CODE_LENGTH = HuffmanCodes::MAX_CODE_LENGTH;
+    static const unsigned char BLOCK_FOUR_STREAMS = 1;  // block layout flags
+    static const unsigned char BLOCK_RANS = 2;
+    static const unsigned char BLOCK_ORDER1 = 4;
+    static const unsigned char ADAPTIVE_STREAM = 0x80;  // marks the adaptive layout
+
+    // adaptive mode settings
+    static const int ADAPTIVE_CHUNK = 1 << 16;          // bytes read per frame
+    static const int ADAPTIVE_CODE_LENGTH = 15;         // code length cap
+    static const int ADAPTIVE_FIRST_REBUILD = 256;      // symbols before first rebuild
+    static const int ADAPTIVE_MAX_INTERVAL = 1 << 15;   // longest gap between rebuilds
+    static const unsigned long long ADAPTIVE_MAX_TOTAL = 1 << 16;  // halve counts above
+
+    static const int PRESET_CODE_LENGTH = 15;           // cap for trained tables
+
+    // order 1 mode settings
+    static const int MAX_CONTEXT_TABLES = 32;   // code tables the 256 contexts share
+    static const int CLUSTER_PASSES = 4;        // rounds of regrouping contexts
+    static const int MISSING_CODE_COST = 24;    // bits charged for a byte a table can't code
+
+    static const int MAX_TREE_NODES = 2 * 256 - 1;  // 256 leaves + 255 parents
+
+    // node arena, reused by every build so no tree allocations happen
+    HuffmanNode nodes[MAX_TREE_NODES];
+    int nodeCount;
+    int root;          // index of root node, -1 if no tree
+
     FrequencyTable freqTable;
-    CodeTable codeTable;
+    HuffmanCodes codes;               // codes in use for whole stream / block
+    int maxCodeLength;                // cap used when building codes
+
+    int blockSize;     // 0 = one classic stream, otherwise bytes per block
+    bool fourStreams;  // split every block into four interleaved streams
+    bool contextModel; // order 1: code tables picked by the previous byte
+    bool ransCoding;   // code blocks with rANS instead of huffman codes
+    int threadCount;   // pool size for block mode
+
+    int loadedPreset;  // preset whose codes are loaded now, -1 if none
+
+    void buildFrequencyTable(const unsigned char* data, int size);
+    int buildHuffmanTree();
+    void collectCodeLengths(int node, int depth, unsigned char* lengths);
+    bool readCodeLengths(const QByteArray& data, int& pos);
+
+    // one independently coded run of input
+    bool buildCodes(const unsigned char* data, int size);
+    bool buildCodesFromTable(int maxLength, HuffmanCodes& target);
+    qint64 countBits(const unsigned char* data, int size);
+    bool writeBits(const unsigned char* data, int size, QByteArray& output);
+    bool appendCodes(const unsigned char* data, int size, qint64 totalBits, QByteArray& output);
+    bool writeStreams(const unsigned char* data, int size, QByteArray& output);
+    bool decodeBits(const unsigned char* data, int size, char* out, qint64 count);
+    bool decodeCodes(const unsigned char* data, int size, qint64 totalBits,
+                     char* out, qint64 count);
+    bool decodeStreams(const unsigned char* data, int size, char* out, qint64 count);
+
+    // order 1 blocks, contexts grouped into a few shared tables
+    void buildContextTables(const ContextFrequencyTable& pairs, const unsigned char* contextMap,
+                            int tableCount, HuffmanCodes* tables, qint64& bits);
+    int groupContexts(const ContextFrequencyTable& pairs, int tableCount,
+                      unsigned char* contextMap, HuffmanCodes* tables, qint64& bits);
+    bool writeContextStreams(const unsigned char* data, int size, QByteArray& output);
+    bool decodeContextStreams(const unsigned char* data, int size, char* out, qint64 count);
 
-    void buildFrequencyTable(const QByteArray& data);
-    HuffmanNode* buildHuffmanTree();
-    void generateCodes(HuffmanNode* node, QString code);
-    void deleteTree(HuffmanNode* node);
+    QByteArray compressBlocks(const QByteArray& input);
+    QByteArray decompressBlocks(const QByteArray& input);
+    static qint64 blockOutputLimit(const unsigned char* src, int size, unsigned char flags);
 
-    // save and load tree structure for decompression
-    void serializeTreeBinary(HuffmanNode* node, QByteArray& output);
-    HuffmanNode* deserializeTreeBinary(const QByteArray& data, int& pos);
+    void rebuildAdaptiveCodes(unsigned long long* counts);
+
+    bool loadPreset(int presetId);
 
 public:
     HuffmanCompressor();
     ~HuffmanCompressor();
 
+    // cap code lengths (8 to 56 bits), e.g. 11 or 12 keeps every code
+    // inside the primary decode table. Shorter caps cost a bit of ratio
+    void setMaxCodeLength(int bits);
+    int getMaxCodeLength() const { return maxCodeLength; }
+
+    // block mode: split input into blocks (e.g. 1 MB) with their own codes
+    // and code them in parallel. 0 keeps the classic single stream
+    // decompress() reads both layouts no matter what is set here
+    void setBlockSize(int bytes);
+    int getBlockSize() const { return blockSize; }
+    void setThreadCount(int threads);
+
+    // code every block as four streams decoded side by side, faster to
+    // decode on one core for 15 extra bytes per block
+    void setFourStreams(bool enabled);
+
+    // order 1 mode: the code for a byte depends on the byte before it.
+    // contexts are grouped into up to 32 tables per block to keep the
+    // header small, decoding stays a table lookup per byte on four
+    // independent streams. Uses the block layout like four streams
+    void setContextModel(bool enabled);
+    bool getContextModel() const { return contextModel; }
+
+    // code every block with rANS from the same histogram: fractional bits
+    // per symbol, a big win on skewed data (mostly ascii logs). Uses the
+    // block layout, four streams doesn't apply then
+    void setRansCoding(bool enabled);
+    bool getRansCoding() const { return ransCoding; }
+
     QByteArray compress(const QByteArray& input);
     QByteArray decompress(const QByteArray& input);
+
+    // one pass adaptive mode: codes follow the data as it goes, so nothing
+    // has to be counted first and memory stays the same for any input size
+    // decompress() also understands this layout
+    bool compressAdaptive(QIODevice* in, QIODevice* out);
+    bool decompressAdaptive(QIODevice* in, QIODevice* out);
+
+    // pretrained tables for small payloads (see huffmanpresets.h)
+    // no histogram, tree or header, the output only starts with the
+    // preset id and the size. trainPreset() gives the 256 code lengths
+    // for a set of sample files, ready to be added as a new preset
+    QByteArray compressWithPreset(const QByteArray& input, int presetId);
+    QByteArray decompressWithPreset(const QByteArray& input);
+    QByteArray trainPreset(DynamicArray<QByteArray>& samples);
+
+    // code tables for other coders' symbols (any alphabet up to 256)
+    // build from counts, store with writeCodeTable, load with
+    // readCodeTable, then code symbols one at a time
+    bool buildCodesFromCounts(const unsigned long long* counts);
+    void writeCodeTable(QByteArray& output);
+    bool readCodeTable(const QByteArray& data, int& pos);
+
+    // same, into a separate table (uses this compressor's length cap)
+    bool buildCodesFromCounts(const unsigned long long* counts, HuffmanCodes& target);
+
+    void writeSymbol(BitWriter& writer, int symbol) const { codes.writeSymbol(writer, symbol); }
+    int readSymbol(BitReader& reader) const { return codes.readSymbol(reader); }
+    int symbolLength(int symbol) const { return codes.table.getLength((unsigned char)symbol); }
 };
 
 #endif // HUFFMANCOMPRESSOR_H
@@ -0,0 +1,79 @@
+#include "huffmanpresets.h"
+#include <cstring>
+
+// Where the tables come from: tools/trainpreset run on real files,
+// each file cut to its first 64 KB:
+//   json  conda repodata_record.json package records, npm package.json
+//         manifests and npm cache index entries (one compact record
+//         each), 554 files, 474 KB
+//   log   dpkg, apt, update-alternatives and npm debug logs,
+//         11 files, 354 KB
+// e.g.  find <corpus> -name '*.json' | trainpreset 1 json -
+// Retrain from a sample of the real traffic when the payloads change.
+// Compressed data only stores the id, so a retrained table that is
+// already out in the wild has to go in under a new id
+static const HuffmanPreset presets[] = {
+    // JSON API records and manifests, 200 B - 4 KB, compact and indented
+    { 1, "json", {
+        15, 15, 15, 15, 15, 15, 15, 15, 15,  8,  5, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+         3, 15,  3, 15, 15, 15, 11, 15, 15, 15, 10, 11,  5,  6,  6,  6,
+         6,  6,  7,  7,  7,  7,  7,  7,  7,  7,  5, 15, 12,  9, 10, 15,
+         9, 10, 10, 10, 10, 10, 13,  9,  9,  9, 14, 14, 10,  9, 10, 10,
+        10, 10, 10,  9,  9, 15, 15, 10, 15, 15, 15, 10, 10, 10,  8,  9,
+        15,  5,  7,  5,  6,  4,  7,  7,  7,  5,  8,  8,  6,  6,  5,  5,
+         5,  9,  5,  5,  5,  7,  8,  9,  8,  7,  9,  8, 15,  8, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15
+    } },
+    // application, package manager and syslog style lines
+    { 2, "log", {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  7, 15, 15,  8, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+         4, 15, 15, 15, 15, 15, 15, 15,  8,  8, 15,  8,  8,  5,  5,  6,
+         5,  5,  5,  7,  6,  7,  6,  7,  8,  8,  6, 15, 10, 15, 10, 15,
+         8, 15, 15,  9,  9, 10, 15, 10, 15, 15, 15, 10, 15, 15, 15, 10,
+        10, 15, 15, 11, 12, 13, 15, 15, 15, 15, 15, 15, 15, 15, 15,  8,
+        15,  5,  6,  5,  5,  4,  6,  6,  6,  5,  8,  7,  5,  5,  5,  5,
+         5, 15,  5,  4,  4,  5,  8,  9,  8,  6,  8, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15
+    } }
+};
+
+static const int PRESET_COUNT = sizeof(presets) / sizeof(presets[0]);
+
+const HuffmanPreset* findHuffmanPreset(int id) {
+    for(int i = 0; i < PRESET_COUNT; i++) {
+        if(presets[i].id == id) return &presets[i];
+    }
+    return nullptr;
+}
+
+const HuffmanPreset* findHuffmanPreset(const char* name) {
+    for(int i = 0; i < PRESET_COUNT; i++) {
+        if(strcmp(presets[i].name, name) == 0) return &presets[i];
+    }
+    return nullptr;
+}
+
+int huffmanPresetCount() {
+    return PRESET_COUNT;
+}
+
+const HuffmanPreset* huffmanPresetAt(int index) {
+    if(index < 0 || index >= PRESET_COUNT) return nullptr;
+    return &presets[index];
+}
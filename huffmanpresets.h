@@ -0,0 +1,21 @@
+#ifndef HUFFMANPRESETS_H
+#define HUFFMANPRESETS_H
+
+// Pretrained Huffman tables for small payloads
+// The lengths come from tools/trainpreset (HuffmanCompressor::trainPreset()
+// on real sample files), pasted into huffmanpresets.cpp. Every byte has a
+// code, so any input works, it just compresses best when it looks like
+// the samples
+struct HuffmanPreset {
+    unsigned char id;            // stored in the compressed file, never reuse one
+    const char* name;
+    unsigned char lengths[256];  // canonical code length per character
+};
+
+const HuffmanPreset* findHuffmanPreset(int id);
+const HuffmanPreset* findHuffmanPreset(const char* name);
+
+int huffmanPresetCount();
+const HuffmanPreset* huffmanPresetAt(int index);
+
+#endif // HUFFMANPRESETS_H
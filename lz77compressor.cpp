@@ -0,0 +1,310 @@
+#include "lz77compressor.h"
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <cstring>
+
+LZ77Compressor::LZ77Compressor()
+    : windowBits(MAX_WINDOW_BITS), searchDepth(32), maxMatch(0),
+      head(nullptr), prev(nullptr) {
+    allocChains();
+}
+
+LZ77Compressor::~LZ77Compressor() {
+    delete[] head;
+    delete[] prev;
+}
+
+void LZ77Compressor::setWindowBits(int bits) {
+    if(bits < MIN_WINDOW_BITS) bits = MIN_WINDOW_BITS;
+    if(bits > MAX_WINDOW_BITS) bits = MAX_WINDOW_BITS;
+    if(bits == windowBits) return;
+    windowBits = bits;
+    allocChains();
+}
+
+void LZ77Compressor::setSearchDepth(int depth) {
+    searchDepth = (depth < 1) ? 1 : depth;
+}
+
+void LZ77Compressor::setMaxMatch(int length) {
+    if(length != 0 && length < MIN_MATCH) length = MIN_MATCH;
+    maxMatch = length;
+}
+
+void LZ77Compressor::allocChains() {
+    delete[] head;
+    delete[] prev;
+    head = new int[1 << HASH_BITS];
+    prev = new int[1 << windowBits];
+}
+
+// bytes in common at a and b, reading no further than limit past b
+static inline int commonLength(const unsigned char* a, const unsigned char* b, int limit) {
+    int len = 0;
+    // 8 bytes at a time, first differing byte is the lowest set bit
+    while(len + 8 <= limit) {
+        quint64 diff = qFromLittleEndian<quint64>(a + len) ^ qFromLittleEndian<quint64>(b + len);
+        if(diff) return len + (qCountTrailingZeroBits(diff) >> 3);
+        len += 8;
+    }
+    while(len < limit && a[len] == b[len]) len++;
+    return len;
+}
+
+// chain head for the 4 bytes at p
+unsigned int LZ77Compressor::hashAt(const unsigned char* p) const {
+    return (qFromLittleEndian<quint32>(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void LZ77Compressor::insertPosition(const unsigned char* data, int pos) {
+    unsigned int h = hashAt(data + pos);
+    prev[pos & ((1 << windowBits) - 1)] = head[h];
+    head[h] = pos;
+}
+
+// walk the chain for pos (pos itself not inserted yet), returns the best
+// length found (0 if none reach MIN_MATCH)
+int LZ77Compressor::findMatch(const unsigned char* data, int pos, int size, int& distance) {
+    int windowMask = (1 << windowBits) - 1;
+    int limit = size - pos;
+    if(maxMatch > 0 && limit > maxMatch) limit = maxMatch;
+
+    int best = MIN_MATCH - 1;
+    int candidate = head[hashAt(data + pos)];
+
+    for(int depth = searchDepth; depth > 0 && candidate >= 0; depth--) {
+        // positions further back than the window may have been overwritten
+        if(pos - candidate > windowMask) break;
+
+        // byte past the current best must match, otherwise it can't be longer
+        if(data[candidate + best] == data[pos + best]) {
+            int len = commonLength(data + candidate, data + pos, limit);
+            if(len > best) {
+                best = len;
+                distance = pos - candidate;
+                if(len >= limit) break;
+            }
+        }
+        candidate = prev[candidate & windowMask];
+    }
+
+    return (best >= MIN_MATCH) ? best : 0;
+}
+
+// greedy parse with one step of lazy matching: a match is put off by one
+// byte when the next position has a longer one
+void LZ77Compressor::findSequences(const unsigned char* data, int size,
+                                   DynamicArray<LZ77Sequence>& sequences) {
+    sequences.clear();
+    for(int i = 0; i < (1 << HASH_BITS); i++) head[i] = -1;
+
+    int last = size - MIN_MATCH;  // last position with 4 bytes to hash
+    int anchor = 0;               // start of pending literals
+    int pos = 0;
+
+    while(pos <= last) {
+        int distance = 0;
+        int length = findMatch(data, pos, size, distance);
+        insertPosition(data, pos);
+
+        if(length == 0) {
+            pos++;
+            continue;
+        }
+
+        if(length < GOOD_MATCH && pos + 1 <= last) {
+            int nextDistance = 0;
+            int nextLength = findMatch(data, pos + 1, size, nextDistance);
+            if(nextLength > length) {
+                pos++;
+                insertPosition(data, pos);
+                length = nextLength;
+                distance = nextDistance;
+            }
+        }
+
+        sequences.add(LZ77Sequence(pos - anchor, length, distance));
+
+        // everything inside the match still goes into the chains
+        int matchEnd = pos + length;
+        for(pos++; pos < matchEnd && pos <= last; pos++) {
+            insertPosition(data, pos);
+        }
+        pos = matchEnd;
+        anchor = pos;
+    }
+
+    if(anchor < size) {
+        sequences.add(LZ77Sequence(size - anchor, 0, 0));
+    }
+}
+
+// length above what the token nibble holds, as 255 255 ... rest
+static unsigned char* writeLength(unsigned char* out, int length) {
+    while(length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+static bool readLength(const unsigned char*& in, const unsigned char* end, int& length) {
+    unsigned char b;
+    do {
+        if(in >= end) return false;
+        b = *in++;
+        if(length > 0x7FFFFFFF - 255) return false;
+        length += b;
+    } while(b == 255);
+    return true;
+}
+
+// Layout:
+//   8 bytes          original size
+//   1 byte           window bits
+//   sequences        token, literal length ext, literals,
+//                    distance (3 bytes), match length ext
+// token high nibble = literal count, low nibble = match length - 4, 15 in
+// either means more length bytes follow. The last sequence is literals only
+QByteArray LZ77Compressor::compress(const QByteArray& input) {
+    if(input.isEmpty()) return QByteArray();
+
+    int n = input.size();
+    const unsigned char* data = (const unsigned char*)input.constData();
+
+    DynamicArray<LZ77Sequence> sequences(1024);
+    findSequences(data, n, sequences);
+
+    // worst case is 15 literals and a 4 byte match over and over: 20 bytes
+    // out for 19 in. Longer literal runs add one byte per 255 on top, so
+    // n / 15 covers both, plus the final literals-only sequence
+    qint64 bound = HEADER_SIZE + (qint64)n + n / 15 + 16;
+    if(bound > 0x7FFFFFFF - 64) return QByteArray();
+
+    QByteArray result((int)bound, 0);
+    unsigned char* out = (unsigned char*)result.data();
+    for(int i = 0; i < 8; i++) out[i] = (unsigned char)(((qint64)n >> (i * 8)) & 0xFF);
+    out[8] = (unsigned char)windowBits;
+    out += HEADER_SIZE;
+
+    const unsigned char* src = data;
+    for(int s = 0; s < sequences.size(); s++) {
+        const LZ77Sequence& seq = sequences[s];
+        int lit = seq.literalLength;
+        int match = seq.matchLength ? seq.matchLength - MIN_MATCH : 0;
+
+        unsigned char* token = out++;
+        *token = (unsigned char)(((lit < 15 ? lit : 15) << 4) | (match < 15 ? match : 15));
+        if(lit >= 15) out = writeLength(out, lit - 15);
+
+        memcpy(out, src, lit);
+        out += lit;
+        src += lit;
+
+        if(seq.matchLength == 0) break;  // final literals
+
+        out[0] = (unsigned char)(seq.distance & 0xFF);
+        out[1] = (unsigned char)((seq.distance >> 8) & 0xFF);
+        out[2] = (unsigned char)((seq.distance >> 16) & 0xFF);
+        out += 3;
+        if(match >= 15) out = writeLength(out, match - 15);
+        src += seq.matchLength;
+    }
+
+    result.resize((int)(out - (unsigned char*)result.data()));
+    return result;
+}
+
+void LZ77Compressor::copyMatch(unsigned char* out, int distance, int length) {
+    const unsigned char* from = out - distance;
+    unsigned char* matchEnd = out + length;
+
+    if(distance < 8) {
+        // close overlap: the first few bytes one at a time, after that
+        // the pattern repeats every step bytes with step >= 8
+        int step = distance * ((8 + distance - 1) / distance);
+        int first = (length < step) ? length : step;
+        for(int i = 0; i < first; i++) out[i] = from[i];
+        from = out + first - step;
+        out += first;
+    }
+
+    // 8 bytes at a time, may run up to 7 bytes into the slack
+    while(out < matchEnd) {
+        memcpy(out, from, 8);
+        out += 8;
+        from += 8;
+    }
+}
+
+QByteArray LZ77Compressor::decompress(const QByteArray& input) {
+    if(input.size() < HEADER_SIZE + 1) return QByteArray();
+
+    const unsigned char* in = (const unsigned char*)input.constData();
+    const unsigned char* inEnd = in + input.size();
+
+    qint64 origSize = 0;
+    for(int i = 0; i < 8; i++) origSize |= (qint64)in[i] << (i * 8);
+    int bits = in[8];
+    in += HEADER_SIZE;
+
+    // a match token is 4 bytes and stands for at most 255 bytes per extra
+    // length byte, so anything bigger than this can't be real
+    qint64 inputBytes = inEnd - in;
+    if(origSize <= 0 || origSize > 0x7FFFFFFF - 64 ||
+        origSize > inputBytes * 255 + 64 ||
+        bits < MIN_WINDOW_BITS || bits > MAX_WINDOW_BITS) {
+        return QByteArray();
+    }
+
+    // room past the end so copies can always move whole words
+    QByteArray result;
+    result.resize((int)origSize + COPY_SLACK);
+    unsigned char* base = (unsigned char*)result.data();
+    unsigned char* out = base;
+    unsigned char* outEnd = base + origSize;
+
+    while(true) {
+        if(in >= inEnd) return QByteArray();
+        unsigned char token = *in++;
+
+        // literals
+        int lit = token >> 4;
+        if(lit == 15 && !readLength(in, inEnd, lit)) return QByteArray();
+        if(lit > inEnd - in || lit > outEnd - out) return QByteArray();
+
+        if(lit <= 16 && inEnd - in >= 16) {
+            memcpy(out, in, 16);
+        } else {
+            memcpy(out, in, lit);
+        }
+        out += lit;
+        in += lit;
+
+        if(out == outEnd) break;
+
+        // match
+        if(inEnd - in < 3) return QByteArray();
+        int distance = in[0] | (in[1] << 8) | (in[2] << 16);
+        in += 3;
+
+        int length = token & 15;
+        if(length == 15 && !readLength(in, inEnd, length)) return QByteArray();
+        length += MIN_MATCH;
+
+        if(distance == 0 || distance > out - base || length > outEnd - out) {
+            return QByteArray();
+        }
+
+        copyMatch(out, distance, length);
+        out += length;
+
+        if(out == outEnd) break;
+    }
+
+    if(in != inEnd) return QByteArray();
+
+    result.resize((int)origSize);
+    return result;
+}
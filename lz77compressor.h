@@ -0,0 +1,72 @@
+#ifndef LZ77COMPRESSOR_H
+#define LZ77COMPRESSOR_H
+
+#include <QByteArray>
+#include "datastructures.h"
+
+// One step of the parse: copy literalLength bytes from the input, then
+// repeat matchLength bytes starting distance bytes back (matchLength is 0
+// for the literals at the very end)
+struct LZ77Sequence {
+    int literalLength;
+    int matchLength;
+    int distance;
+
+    LZ77Sequence() : literalLength(0), matchLength(0), distance(0) {}
+    LZ77Sequence(int lit, int len, int dist)
+        : literalLength(lit), matchLength(len), distance(dist) {}
+};
+
+class LZ77Compressor {
+private:
+    static const int HASH_BITS = 16;         // 4 byte hash -> chain head
+    static const int MIN_WINDOW_BITS = 16;   // 64 KB
+    static const int MAX_WINDOW_BITS = 20;   // 1 MB
+    static const int GOOD_MATCH = 32;        // skip the lazy check above this
+    static const int HEADER_SIZE = 9;        // original size + window bits
+
+    int windowBits;
+    int searchDepth;  // chain links followed per position
+    int maxMatch;     // longest match the parse gives back
+
+    // hash chains: head holds the newest position per hash, prev links each
+    // position to the previous one with the same hash (ring of window size)
+    int* head;
+    int* prev;
+
+    void allocChains();
+    unsigned int hashAt(const unsigned char* p) const;
+    void insertPosition(const unsigned char* data, int pos);
+    int findMatch(const unsigned char* data, int pos, int size, int& distance);
+
+public:
+    static const int MIN_MATCH = 4;          // shortest match worth a sequence
+    static const int COPY_SLACK = 32;        // spare output bytes for wide copies
+
+    LZ77Compressor();
+    ~LZ77Compressor();
+
+    // sliding window, 16 (64 KB) to 20 (1 MB) bits
+    void setWindowBits(int bits);
+    int getWindowBits() const { return windowBits; }
+
+    // more links = better matches but slower compression
+    void setSearchDepth(int depth);
+    int getSearchDepth() const { return searchDepth; }
+
+    // cap on match length, 0 = no cap
+    void setMaxMatch(int length);
+
+    // parse input into literal runs and matches
+    void findSequences(const unsigned char* data, int size,
+                       DynamicArray<LZ77Sequence>& sequences);
+
+    // repeat length bytes from distance back, whole words at a time
+    // (out needs COPY_SLACK writable bytes past the match)
+    static void copyMatch(unsigned char* out, int distance, int length);
+
+    QByteArray compress(const QByteArray& input);
+    QByteArray decompress(const QByteArray& input);
+};
+
+#endif // LZ77COMPRESSOR_H
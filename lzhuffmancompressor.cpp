@@ -0,0 +1,386 @@
+#include "lzhuffmancompressor.h"
+#include <QtAlgorithms>
+#include <cstring>
+
+LZHuffmanCompressor::LZHuffmanCompressor() : ransCoding(false), sequences(1024) {
+    for(int k = 0; k < CLASS_COUNT; k++) {
+        tables[k].setMaxCodeLength(CODE_LENGTH);
+    }
+}
+
+// lengths and distances are coded as a symbol plus extra bits:
+// small values are a symbol each, after that every power of two is split
+// into two symbols and the extra bits give the position inside
+// (same idea as deflate's length and distance codes)
+int LZHuffmanCompressor::valueSymbol(unsigned int value, int& extraBits, unsigned int& extra) {
+    if(value < SMALL_VALUE) {
+        extraBits = 0;
+        extra = 0;
+        return (int)value;
+    }
+    int top = 31 - (int)qCountLeadingZeroBits(value);  // highest set bit, >= 4
+    extraBits = top - 1;
+    extra = value & ((1u << extraBits) - 1);
+    return SMALL_VALUE + (top - 4) * 2 + (int)((value >> extraBits) & 1);
+}
+
+template<class Source>
+bool LZHuffmanCompressor::readValue(Source& source, int symbolClass, unsigned int& value) {
+    int symbol = source.symbol(symbolClass);
+    if(symbol < 0) return false;
+    if(symbol < SMALL_VALUE) {
+        value = (unsigned int)symbol;
+        return true;
+    }
+    int top = (symbol - SMALL_VALUE) / 2 + 4;
+    if(top > 30) return false;
+    int extraBits = top - 1;
+    value = (1u << top) | ((unsigned int)((symbol - SMALL_VALUE) & 1) << extraBits);
+    value |= source.bits(extraBits);
+    return true;
+}
+
+// where the symbols of a block go: straight into the bit stream as
+// huffman codes, or kept for the rANS pass with the extra bits on their own
+struct HuffmanSink {
+    const HuffmanCompressor* tables;
+    BitWriter* writer;
+
+    void symbol(int symbolClass, int symbol) { tables[symbolClass].writeSymbol(*writer, symbol); }
+    void bits(unsigned int value, int count) { writer->write(value, count); }
+};
+
+struct RansSink {
+    quint16* next;     // (class << 8) | symbol
+    BitWriter* writer;
+
+    void symbol(int symbolClass, int symbol) { *next++ = (quint16)((symbolClass << 8) | symbol); }
+    void bits(unsigned int value, int count) { writer->write(value, count); }
+};
+
+// and where they come from when decoding
+struct HuffmanSource {
+    const HuffmanCompressor* tables;
+    BitReader* reader;
+
+    int symbol(int symbolClass) { return tables[symbolClass].readSymbol(*reader); }
+    unsigned int bits(int count) { return reader->read(count); }
+};
+
+struct RansSource {
+    const RANSCoder* models;
+    RANSDecoder* decoder;
+    BitReader* reader;
+    int index;   // symbols so far, picks the lane
+
+    int symbol(int symbolClass) {
+        return decoder->get(models[symbolClass], index++ & (RANSCoder::LANES - 1));
+    }
+    unsigned int bits(int count) { return reader->read(count); }
+};
+
+// per sequence: literal length, literals, match length, distance
+template<class Sink>
+void LZHuffmanCompressor::writeSequences(int first, int last, const unsigned char*& src, Sink& sink) {
+    for(int s = first; s < last; s++) {
+        const LZ77Sequence& seq = sequences[s];
+        int extraBits;
+        unsigned int extra;
+
+        if(seq.matchLength != 0) {
+            sink.symbol(LITERAL_LENGTHS, valueSymbol(seq.literalLength, extraBits, extra));
+            if(extraBits) sink.bits(extra, extraBits);
+        }
+
+        for(int i = 0; i < seq.literalLength; i++) sink.symbol(LITERALS, src[i]);
+        src += seq.literalLength;
+
+        if(seq.matchLength == 0) continue;
+
+        sink.symbol(MATCH_LENGTHS, valueSymbol(seq.matchLength - LZ77Compressor::MIN_MATCH, extraBits, extra));
+        if(extraBits) sink.bits(extra, extraBits);
+        sink.symbol(DISTANCES, valueSymbol(seq.distance - 1, extraBits, extra));
+        if(extraBits) sink.bits(extra, extraBits);
+        src += seq.matchLength;
+    }
+}
+
+static void appendInt32(QByteArray& output, int value) {
+    for(int i = 0; i < 4; i++) output.append((char)((value >> (i * 8)) & 0xFF));
+}
+
+static int readInt32(const unsigned char* src) {
+    int value = 0;
+    for(int i = 0; i < 4; i++) value |= (int)src[i] << (i * 8);
+    return value;
+}
+
+// Block layout:
+//   4 bytes          sequences with a match
+//   4 bytes          literals after the last match (only in the last block)
+//   4 code tables    0 = class not used, or 1 + code lengths (rANS table with rANS)
+//   4 bytes          size of the coded bits
+//   bits             per sequence: literal length, literals, match length,
+//                    distance, then the trailing literals
+// with rANS the symbols and the extra bits are split:
+//   4 bytes          size of the rANS data, then the rANS data
+//   4 bytes          size of the extra bits, then the extra bits
+// false if the block can't fit in a QByteArray
+bool LZHuffmanCompressor::writeBlock(int first, int last, const unsigned char*& src,
+                                     QByteArray& output) {
+    unsigned long long counts[CLASS_COUNT][256];
+    memset(counts, 0, sizeof(counts));
+
+    // count symbols of every class, and how many bits could come out
+    qint64 symbols = 0;
+    qint64 extraTotal = 0;
+    int matchCount = 0;
+    int tailLiterals = 0;
+    const unsigned char* p = src;
+    for(int s = first; s < last; s++) {
+        const LZ77Sequence& seq = sequences[s];
+        int extraBits;
+        unsigned int extra;
+
+        for(int i = 0; i < seq.literalLength; i++) counts[LITERALS][p[i]]++;
+        symbols += seq.literalLength;
+        p += seq.literalLength;
+
+        if(seq.matchLength == 0) {
+            tailLiterals = seq.literalLength;
+            continue;
+        }
+
+        counts[LITERAL_LENGTHS][valueSymbol(seq.literalLength, extraBits, extra)]++;
+        extraTotal += extraBits;
+        counts[MATCH_LENGTHS][valueSymbol(seq.matchLength - LZ77Compressor::MIN_MATCH, extraBits, extra)]++;
+        extraTotal += extraBits;
+        counts[DISTANCES][valueSymbol(seq.distance - 1, extraBits, extra)]++;
+        extraTotal += extraBits;
+        symbols += 3;
+        p += seq.matchLength;
+        matchCount++;
+    }
+
+    appendInt32(output, matchCount);
+    appendInt32(output, tailLiterals);
+
+    for(int k = 0; k < CLASS_COUNT; k++) {
+        bool built = ransCoding ? models[k].buildFromCounts(counts[k])
+                                : tables[k].buildCodesFromCounts(counts[k]);
+        if(built) {
+            output.append((char)1);
+            if(ransCoding) models[k].writeTable(output);
+            else tables[k].writeCodeTable(output);
+        } else {
+            output.append((char)0);
+        }
+    }
+
+    if(ransCoding) {
+        // rANS codes backwards, so the symbols are collected first
+        if((extraTotal + 7) / 8 + 8 > 0x7FFFFFFF) return false;
+        quint16* coded = new quint16[symbols];
+        QByteArray extraBytes((int)((extraTotal + 7) / 8) + 8, 0);
+        BitWriter writer((unsigned char*)extraBytes.data());
+        RansSink sink = { coded, &writer };
+        writeSequences(first, last, src, sink);
+        writer.flush();
+
+        RANSEncoder encoder((int)symbols);
+        for(qint64 i = symbols - 1; i >= 0; i--) {
+            encoder.put(models[coded[i] >> 8], coded[i] & 0xFF, (int)(i & (RANSCoder::LANES - 1)));
+        }
+        delete[] coded;
+
+        int sizePos = output.size();
+        appendInt32(output, 0);
+        int bytes = encoder.finish(output);
+        for(int i = 0; i < 4; i++) output[sizePos + i] = (char)((bytes >> (i * 8)) & 0xFF);
+
+        int extraSize = (int)writer.bytesWritten();
+        appendInt32(output, extraSize);
+        output.append(QByteArray::fromRawData(extraBytes.constData(), extraSize));
+        return true;
+    }
+
+    // every code is at most CODE_LENGTH bits
+    qint64 maxBytes = (symbols * CODE_LENGTH + extraTotal + 7) / 8;
+    if(output.size() + 4 + maxBytes + 8 > 0x7FFFFFFF) return false;
+
+    int sizePos = output.size();
+    appendInt32(output, 0);
+    int dataStart = output.size();
+    output.resize(dataStart + (int)maxBytes + 8);
+
+    BitWriter writer((unsigned char*)output.data() + dataStart);
+    HuffmanSink sink = { tables, &writer };
+    writeSequences(first, last, src, sink);
+    writer.flush();
+
+    int bytes = (int)writer.bytesWritten();
+    output.resize(dataStart + bytes);
+    for(int i = 0; i < 4; i++) output[sizePos + i] = (char)((bytes >> (i * 8)) & 0xFF);
+    return true;
+}
+
+// Layout:
+//   8 bytes          original size
+//   4 bytes          block count
+//   blocks           see writeBlock
+// with rANS the same behind a marker:
+//   FF FF FF FF      marker, no original size starts like this
+//   1 byte           flags (STREAM_RANS)
+// matches may reach back into earlier blocks, only the codes are per block
+QByteArray LZHuffmanCompressor::compress(const QByteArray& input) {
+    if(input.isEmpty()) return QByteArray();
+
+    const unsigned char* data = (const unsigned char*)input.constData();
+    matcher.findSequences(data, input.size(), sequences);
+
+    int blockCount = (sequences.size() + BLOCK_SEQUENCES - 1) / BLOCK_SEQUENCES;
+
+    QByteArray result;
+    result.reserve(input.size() / 2 + 64);
+    if(ransCoding) {
+        for(int i = 0; i < 4; i++) result.append((char)0xFF);
+        result.append((char)STREAM_RANS);
+    }
+    qint64 origSize = input.size();
+    for(int i = 0; i < 8; i++) result.append((char)((origSize >> (i * 8)) & 0xFF));
+    appendInt32(result, blockCount);
+
+    const unsigned char* src = data;
+    for(int b = 0; b < blockCount; b++) {
+        int first = b * BLOCK_SEQUENCES;
+        int last = first + BLOCK_SEQUENCES;
+        if(last > sequences.size()) last = sequences.size();
+        if(!writeBlock(first, last, src, result)) return QByteArray();
+    }
+
+    return result;
+}
+
+// one block of sequences back into bytes, symbols come from source
+template<class Source>
+bool LZHuffmanCompressor::readSequences(Source& source, int matchCount, int tailLiterals,
+                                        bool literals, unsigned char* base,
+                                        unsigned char*& out, unsigned char* outEnd) {
+    for(int s = 0; s <= matchCount; s++) {
+        unsigned int litLength = (unsigned int)tailLiterals;
+        if(s < matchCount && !readValue(source, LITERAL_LENGTHS, litLength)) return false;
+
+        if(litLength > (unsigned int)(outEnd - out)) return false;
+        if(litLength > 0 && !literals) return false;
+        for(unsigned int i = 0; i < litLength; i++) {
+            int c = source.symbol(LITERALS);
+            if(c < 0) return false;
+            *out++ = (unsigned char)c;
+        }
+
+        if(s == matchCount) break;  // trailing literals, no match
+
+        unsigned int length, distance;
+        if(!readValue(source, MATCH_LENGTHS, length) ||
+            !readValue(source, DISTANCES, distance)) {
+            return false;
+        }
+        length += LZ77Compressor::MIN_MATCH;
+        distance += 1;
+
+        if(distance > (unsigned int)(out - base) || length > (unsigned int)(outEnd - out)) {
+            return false;
+        }
+        LZ77Compressor::copyMatch(out, (int)distance, (int)length);
+        out += length;
+    }
+    return true;
+}
+
+QByteArray LZHuffmanCompressor::decompress(const QByteArray& input) {
+    const unsigned char* in = (const unsigned char*)input.constData();
+
+    bool rans = false;
+    int pos = 0;
+    if(input.size() >= 5 && in[0] == 0xFF && in[1] == 0xFF && in[2] == 0xFF && in[3] == 0xFF) {
+        if(in[4] & ~STREAM_RANS) return QByteArray();  // from a newer version
+        rans = (in[4] & STREAM_RANS) != 0;
+        pos = 5;
+    }
+    if(input.size() - pos < 12) return QByteArray();
+
+    qint64 origSize = 0;
+    for(int i = 0; i < 8; i++) origSize |= (qint64)in[pos + i] << (i * 8);
+    int blockCount = readInt32(in + pos + 8);
+    pos += 12;
+
+    // a sequence takes at least one bit and can't stand for more than
+    // 2^31 bytes, so this is only a sanity bound against broken headers
+    if(origSize <= 0 || origSize > 0x7FFFFFFF - 64 || blockCount <= 0) {
+        return QByteArray();
+    }
+
+    QByteArray result;
+    result.resize((int)origSize + LZ77Compressor::COPY_SLACK);
+    unsigned char* base = (unsigned char*)result.data();
+    unsigned char* out = base;
+    unsigned char* outEnd = base + origSize;
+
+    for(int b = 0; b < blockCount; b++) {
+        if(input.size() - pos < 8) return QByteArray();
+        int matchCount = readInt32(in + pos);
+        int tailLiterals = readInt32(in + pos + 4);
+        pos += 8;
+        if(matchCount < 0 || tailLiterals < 0) return QByteArray();
+
+        bool present[CLASS_COUNT];
+        for(int k = 0; k < CLASS_COUNT; k++) {
+            if(pos >= input.size()) return QByteArray();
+            present[k] = in[pos++] != 0;
+            if(!present[k]) continue;
+            bool loaded = rans ? models[k].readTable(input, pos) : tables[k].readCodeTable(input, pos);
+            if(!loaded) return QByteArray();
+        }
+        if(matchCount > 0 && !(present[LITERAL_LENGTHS] && present[MATCH_LENGTHS] && present[DISTANCES])) {
+            return QByteArray();
+        }
+
+        if(input.size() - pos < 4) return QByteArray();
+        int bytes = readInt32(in + pos);
+        pos += 4;
+        if(bytes < 0 || bytes > input.size() - pos) return QByteArray();
+
+        if(rans) {
+            RANSDecoder decoder(in + pos, bytes);
+            pos += bytes;
+
+            if(input.size() - pos < 4) return QByteArray();
+            int extraSize = readInt32(in + pos);
+            pos += 4;
+            if(extraSize < 0 || extraSize > input.size() - pos) return QByteArray();
+
+            BitReader reader(in + pos, extraSize);
+            RansSource source = { models, &decoder, &reader, 0 };
+            if(!readSequences(source, matchCount, tailLiterals, present[LITERALS], base, out, outEnd)) {
+                return QByteArray();
+            }
+            if(!decoder.finished() || reader.position() > (qint64)extraSize * 8) return QByteArray();
+            pos += extraSize;
+            continue;
+        }
+
+        BitReader reader(in + pos, bytes);
+        HuffmanSource source = { tables, &reader };
+        if(!readSequences(source, matchCount, tailLiterals, present[LITERALS], base, out, outEnd)) {
+            return QByteArray();
+        }
+
+        if(reader.position() > (qint64)bytes * 8) return QByteArray();
+        pos += bytes;
+    }
+
+    if(out != outEnd || pos != input.size()) return QByteArray();
+
+    result.resize((int)origSize);
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef LZHUFFMANCOMPRESSOR_H
+#define LZHUFFMANCOMPRESSOR_H
+
+#include <QByteArray>
+#include "datastructures.h"
+#include "huffmancompressor.h"
+#include "lz77compressor.h"
+#include "ranscoder.h"
+
+// Deflate style pipeline: LZ77 finds the repeats, then every part of a
+// sequence is huffman coded with a code table for its own symbol class
+class LZHuffmanCompressor {
+private:
+    static const int BLOCK_SEQUENCES = 1 << 16;  // sequences per block / code set
+    static const int CODE_LENGTH = 15;           // code length cap for all tables
+    static const int SMALL_VALUE = 16;           // values below this are their own symbol
+
+    // symbol classes, each gets its own huffman code per block
+    static const int LITERALS = 0;          // raw bytes
+    static const int LITERAL_LENGTHS = 1;   // literal run before a match
+    static const int MATCH_LENGTHS = 2;     // match length - MIN_MATCH
+    static const int DISTANCES = 3;         // match distance - 1
+    static const int CLASS_COUNT = 4;
+
+    static const unsigned char STREAM_RANS = 1;  // layout flag
+
+    bool ransCoding;   // rANS tables instead of huffman codes
+
+    LZ77Compressor matcher;
+    HuffmanCompressor tables[CLASS_COUNT];
+    RANSCoder models[CLASS_COUNT];
+    DynamicArray<LZ77Sequence> sequences;
+
+    static int valueSymbol(unsigned int value, int& extraBits, unsigned int& extra);
+    template<class Source>
+    static bool readValue(Source& source, int symbolClass, unsigned int& value);
+
+    template<class Sink>
+    void writeSequences(int first, int last, const unsigned char*& src, Sink& sink);
+    bool writeBlock(int first, int last, const unsigned char*& src, QByteArray& output);
+    template<class Source>
+    static bool readSequences(Source& source, int matchCount, int tailLiterals, bool literals,
+                              unsigned char* base, unsigned char*& out, unsigned char* outEnd);
+
+public:
+    LZHuffmanCompressor();
+    ~LZHuffmanCompressor() {}
+
+    // match finder settings, see LZ77Compressor
+    void setWindowBits(int bits) { matcher.setWindowBits(bits); }
+    void setSearchDepth(int depth) { matcher.setSearchDepth(depth); }
+
+    // rANS for every symbol class: fractional bits per symbol, so
+    // skewed literals and lengths cost less. decompress() reads both
+    void setRansCoding(bool enabled) { ransCoding = enabled; }
+    bool getRansCoding() const { return ransCoding; }
+
+    QByteArray compress(const QByteArray& input);
+    QByteArray decompress(const QByteArray& input);
+};
+
+#endif // LZHUFFMANCOMPRESSOR_H
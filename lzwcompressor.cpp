@@ -1,164 +1,298 @@
 #include "lzwcompressor.h"
+#include "datastructures.h"
 #include <QByteArray>
+#include <cstring>
 
-struct HashEntry {
-    QByteArray sequence;
-    int code;
-    bool used;
-    HashEntry() : code(-1), used(false) {}
-};
-
-// hash function for byte arrays
-static unsigned int hashBytes(const QByteArray& data) {
-    unsigned int hash = 5381;
-    for(int i = 0; i < data.size(); i++) {
-        hash = ((hash << 5) + hash) + (unsigned char)data[i];
-    }
-    return hash;
+LZWCompressor::LZWCompressor()
+    : maxBits(DEFAULT_MAX_BITS), hashKey(nullptr), hashCode(nullptr), hashSize(0),
+      hashBits(0), entryPrefix(nullptr), entryLast(nullptr), entryLength(nullptr),
+      entryCapacity(0) {
+    allocHash();
 }
 
-void LZWCompressor::initDictionary() {
-    // initialize with all single byte values (0-255)
-    for(int i = 0; i < 256; i++) {
-        dictionary[i].str = QString(QChar(i));
-        dictionary[i].code = i;
-        dictionary[i].used = true;
+LZWCompressor::~LZWCompressor() {
+    delete[] hashKey;
+    delete[] hashCode;
+    delete[] entryPrefix;
+    delete[] entryLast;
+    delete[] entryLength;
+}
 
-        reverseDictionary[i] = QString(QChar(i));
-    }
+void LZWCompressor::setMaxBits(int bits) {
+    if(bits < MIN_MAX_BITS) bits = MIN_MAX_BITS;
+    if(bits > MAX_MAX_BITS) bits = MAX_MAX_BITS;
+    if(bits == maxBits) return;
+    maxBits = bits;
+    allocHash();
+}
 
-    // rest are empty
-    for(int i = 256; i < MAX_DICT_SIZE; i++) {
-        dictionary[i].used = false;
-        reverseDictionary[i] = "";
-    }
+// hash table is kept at twice the dictionary size
+void LZWCompressor::allocHash() {
+    delete[] hashKey;
+    delete[] hashCode;
+    hashSize = 2 << maxBits;
+    hashKey = new int[hashSize];
+    hashCode = new int[hashSize];
 }
 
-int LZWCompressor::findInDictionary(const QString& s) {
-    // search through dictionary
-    for(int i = 0; i < MAX_DICT_SIZE; i++) {
-        if(dictionary[i].used && dictionary[i].str == s) {
-            return dictionary[i].code;
+// decode side dictionary, grown to the widest stream seen so far
+void LZWCompressor::allocEntries(int count) {
+    if(count > entryCapacity) {
+        delete[] entryPrefix;
+        delete[] entryLast;
+        delete[] entryLength;
+        entryCapacity = count;
+        entryPrefix = new int[count];
+        entryLast = new unsigned char[count];
+        entryLength = new int[count];
+
+        // single bytes (0-255) never change
+        for(int i = 0; i < 256; i++) {
+            entryPrefix[i] = -1;
+            entryLast[i] = (unsigned char)i;
+            entryLength[i] = 1;
         }
     }
-    return -1;
 }
 
+// single bytes are codes 0-255 and never stored, so the table starts empty
+// only the part a dictionary of 1 << bits entries needs is used
+void LZWCompressor::clearHash(int bits) {
+    hashBits = bits + 1;
+    memset(hashKey, 0xFF, sizeof(int) << hashBits);  // all -1
+}
+
+// open addressing with linear probing, the table is never more than
+// half full so a free slot always turns up quickly
+int LZWCompressor::findSlot(int prefix, unsigned char ch) {
+    int key = (prefix << 8) | ch;
+    unsigned int slot = ((unsigned int)key * 2654435761u) >> (32 - hashBits);
+    while(hashKey[slot] != -1 && hashKey[slot] != key) {
+        slot = (slot + 1) & ((1 << hashBits) - 1);
+    }
+    return (int)slot;
+}
+
+// Layout:
+//   FF FF FF FF      marker, can't be the size field of the old layout
+//   1 byte           max code width
+//   8 bytes          original size
+//   codes            bit packed, msb first
+// Codes start 9 bits wide and grow by one bit whenever the next free code
+// would not fit, up to the max width. 256 is CLEAR: once the dictionary is
+// full and the ratio starts dropping it is thrown away and rebuilt
 QByteArray LZWCompressor::compress(const QByteArray& input) {
     if(input.isEmpty()) return QByteArray();
 
-    initDictionary();
-    int dictSize = 256;
+    int n = input.size();
 
-    QByteArray result;
+    // every code comes from one input byte, so a short input never
+    // fills a big dictionary and a narrower one does the same job
+    int bits = MIN_MAX_BITS;
+    while(bits < maxBits && (1 << bits) < (qint64)n + FIRST_CODE) bits++;
+    int maxCodes = 1 << bits;
 
-    // store original size first (4 bytes)
-    int origSize = input.size();
-    result.append((char)(origSize & 0xFF));
-    result.append((char)((origSize >> 8) & 0xFF));
-    result.append((char)((origSize >> 16) & 0xFF));
-    result.append((char)((origSize >> 24) & 0xFF));
-
-    QString current = "";
-
-    for(int i = 0; i < input.size(); i++) {
-        QChar ch = QChar((unsigned char)input[i]);
-        QString combined = current + ch;
-
-        if(findInDictionary(combined) != -1) {
-            current = combined;
-        } else {
-            // output code for current string
-            int code = findInDictionary(current);
-            if(code != -1) {
-                result.append((char)(code & 0xFF));
-                result.append((char)((code >> 8) & 0x0F));
-            }
+    // every byte could end up a code of its own, plus the CLEAR codes
+    qint64 codeBound = (qint64)n + n / CHECK_GAP + 2;
+    qint64 outBound = HEADER_SIZE + (codeBound * bits + 7) / 8 + 8;
+    if(outBound > 0x7FFFFFFF - 64) return QByteArray();
+
+    QByteArray result((int)outBound, 0);
+    unsigned char* out = (unsigned char*)result.data();
+
+    for(int i = 0; i < 4; i++) out[i] = 0xFF;
+    out[4] = (unsigned char)bits;
+    for(int i = 0; i < 8; i++) out[5 + i] = (unsigned char)(((qint64)n >> (i * 8)) & 0xFF);
+
+    clearHash(bits);
+    int nextCode = FIRST_CODE;
+    int width = MIN_BITS;
 
+    // ratio check, same idea as compress(1)
+    qint64 checkpoint = CHECK_GAP;
+    qint64 bestRatio = 0;
+
+    BitWriter writer(out + HEADER_SIZE);
+    const unsigned char* data = (const unsigned char*)input.constData();
+    int current = data[0];  // code of the string matched so far
+
+    for(int i = 1; i < n; i++) {
+        unsigned char ch = data[i];
+        int slot = findSlot(current, ch);
+
+        if(hashKey[slot] != -1) {
+            current = hashCode[slot];
+            continue;
+        }
+
+        // output code for current string
+        writer.write(current, width);
+
+        if(nextCode < maxCodes) {
             // add new sequence to dictionary
-            if(dictSize < MAX_DICT_SIZE) {
-                dictionary[dictSize].str = combined;
-                dictionary[dictSize].code = dictSize;
-                dictionary[dictSize].used = true;
-                dictSize++;
+            hashKey[slot] = (current << 8) | ch;
+            hashCode[slot] = nextCode++;
+            if(nextCode > (1 << width) && width < bits) width++;
+        } else if(i >= checkpoint) {
+            // dictionary is full, keep it only while it still pays off
+            checkpoint = i + CHECK_GAP;
+            qint64 ratio = ((qint64)i << 8) / (writer.bytesWritten() + 1);
+            if(ratio > bestRatio) {
+                bestRatio = ratio;
+            } else {
+                writer.write(CLEAR_CODE, width);
+                clearHash(bits);
+                nextCode = FIRST_CODE;
+                width = MIN_BITS;
+                bestRatio = 0;
             }
-
-            current = QString(ch);
         }
+
+        current = ch;
     }
 
     // output last code
-    if(!current.isEmpty()) {
-        int code = findInDictionary(current);
-        if(code != -1) {
-            result.append((char)(code & 0xFF));
-            result.append((char)((code >> 8) & 0x0F));
-        }
-    }
+    writer.write(current, width);
+    writer.flush();
 
+    result.resize(HEADER_SIZE + (int)writer.bytesWritten());
     return result;
 }
 
 QByteArray LZWCompressor::decompress(const QByteArray& input) {
-    if(input.size() < 6) return QByteArray();
+    if(input.size() < 4) return QByteArray();
 
-    // read original size
-    int origSize = ((unsigned char)input[0]) |
-                   ((unsigned char)input[1] << 8) |
-                   ((unsigned char)input[2] << 16) |
-                   ((unsigned char)input[3] << 24);
+    const unsigned char* in = (const unsigned char*)input.constData();
+    if(in[0] == 0xFF && in[1] == 0xFF && in[2] == 0xFF && in[3] == 0xFF) {
+        return decompressCodes(input);
+    }
+    return decompressLegacy(input);
+}
 
-    if(origSize <= 0 || origSize > 100000000) {
-        return QByteArray();
+// Dictionary entries are (prefix code, last byte, length), so a code is
+// expanded by walking its prefixes and writing the bytes from the back.
+// Everything goes straight into the output buffer, nothing is allocated
+// per code. Returns false on a code that can't be valid
+bool LZWCompressor::expandCode(int code, int& prev, int& nextCode, int maxCodes,
+                               unsigned char* out, qint64& pos, qint64 size) {
+    int length;
+    if(code < nextCode) {
+        length = entryLength[code];
+        if(pos + length > size) return false;
+        int c = code;
+        for(qint64 p = pos + length - 1; p >= pos; p--) {
+            out[p] = entryLast[c];
+            c = entryPrefix[c];
+        }
+    } else if(code == nextCode && prev >= 0) {
+        // special case: code not in dictionary yet, it is prev plus the
+        // first byte of prev, and prev was written just before pos
+        length = entryLength[prev] + 1;
+        if(pos + length > size) return false;
+        qint64 prevPos = pos - entryLength[prev];
+        memcpy(out + pos, out + prevPos, length - 1);
+        out[pos + length - 1] = out[prevPos];
+    } else {
+        return false;
     }
 
-    initDictionary();
-    int dictSize = 256;
+    // add new entry to dictionary: prev plus first byte of this one
+    if(prev >= 0 && nextCode < maxCodes) {
+        entryPrefix[nextCode] = prev;
+        entryLast[nextCode] = out[pos];
+        entryLength[nextCode] = entryLength[prev] + 1;
+        nextCode++;
+    }
 
-    QByteArray result;
-    result.reserve(origSize);
+    pos += length;
+    prev = code;
+    return true;
+}
 
-    if(input.size() < 6) return QByteArray();
-    int prevCode = ((unsigned char)input[4]) |
-                   (((unsigned char)input[5] & 0x0F) << 8);
+QByteArray LZWCompressor::decompressCodes(const QByteArray& input) {
+    if(input.size() < HEADER_SIZE) return QByteArray();
+    const unsigned char* in = (const unsigned char*)input.constData();
 
-    if(prevCode >= 256) return QByteArray();
+    int bits = in[4];
+    if(bits < MIN_MAX_BITS || bits > MAX_MAX_BITS) return QByteArray();
+    int maxCodes = 1 << bits;
 
-    QString prevStr = reverseDictionary[prevCode];
-    result.append(prevStr.toUtf8());
+    qint64 origSize = 0;
+    for(int i = 0; i < 8; i++) origSize |= (qint64)in[5 + i] << (i * 8);
 
-    // process remaining codes
-    for(int i = 6; i < input.size(); i += 2) {
-        if(i + 1 >= input.size()) break;
+    // a code never expands to more than maxCodes bytes
+    qint64 totalBits = (qint64)(input.size() - HEADER_SIZE) * 8;
+    if(origSize <= 0 || origSize > 0x7FFFFFFF - 64 ||
+        origSize > (totalBits / MIN_BITS) * maxCodes) {
+        return QByteArray();
+    }
 
-        int code = ((unsigned char)input[i]) |
-                   (((unsigned char)input[i+1] & 0x0F) << 8);
+    allocEntries(maxCodes);
 
-        QString entry;
+    QByteArray result;
+    result.resize((int)origSize);
+    unsigned char* out = (unsigned char*)result.data();
+    qint64 pos = 0;
+
+    BitReader reader(in + HEADER_SIZE, input.size() - HEADER_SIZE);
+    int nextCode = FIRST_CODE;
+    int width = MIN_BITS;
+    int prev = -1;  // previous code, -1 right after a CLEAR
+
+    while(pos < origSize) {
+        // decoder is one entry behind the encoder, except after a CLEAR
+        int needed = nextCode + (prev >= 0 ? 1 : 0);
+        while(needed > (1 << width) && width < bits) width++;
+
+        if(reader.position() + width > totalBits) return QByteArray();
+        int code = (int)reader.read(width);
+
+        if(code == CLEAR_CODE) {
+            nextCode = FIRST_CODE;
+            width = MIN_BITS;
+            prev = -1;
+            continue;
+        }
 
-        if(code < dictSize && !reverseDictionary[code].isEmpty()) {
-            entry = reverseDictionary[code];
-        } else if(code == dictSize) {
-            // special case: code not in dictionary yet
-            entry = prevStr + prevStr[0];
-        } else {
-            break;
+        if(!expandCode(code, prev, nextCode, maxCodes, out, pos, origSize)) {
+            return QByteArray();
         }
+    }
 
-        result.append(entry.toUtf8());
+    return result;
+}
 
-        if(result.size() >= origSize) {
-            return result.left(origSize);
-        }
+// old layout: 4 byte size, then fixed 12 bit codes in 16 bit slots
+// (no CLEAR code there, new strings start right at 256)
+QByteArray LZWCompressor::decompressLegacy(const QByteArray& input) {
+    if(input.size() < 6) return QByteArray();
+    const unsigned char* in = (const unsigned char*)input.constData();
 
-        // add new entry to dictionary
-        if(dictSize < MAX_DICT_SIZE) {
-            reverseDictionary[dictSize] = prevStr + entry[0];
-            dictSize++;
-        }
+    // read original size
+    int origSize = in[0] | (in[1] << 8) | (in[2] << 16) | (in[3] << 24);
+
+    if(origSize <= 0 || origSize > 100000000) {
+        return QByteArray();
+    }
+
+    allocEntries(LEGACY_DICT_SIZE);
+
+    QByteArray result;
+    result.resize(origSize);
+    unsigned char* out = (unsigned char*)result.data();
+    qint64 pos = 0;
 
-        prevStr = entry;
+    int nextCode = 256;
+    int prev = -1;
+
+    for(int i = 4; i + 1 < input.size() && pos < origSize; i += 2) {
+        int code = in[i] | ((in[i + 1] & 0x0F) << 8);
+        if(!expandCode(code, prev, nextCode, LEGACY_DICT_SIZE, out, pos, origSize)) {
+            break;
+        }
     }
 
+    // old decoder handed back whatever it managed to decode
+    result.resize((int)pos);
     return result;
 }
@@ -2,29 +2,51 @@
 #define LZWCOMPRESSOR_H
 
 #include <QByteArray>
-#include <QString>
 
 class LZWCompressor {
 private:
-    static const int MAX_DICT_SIZE = 4096;  // max dictionary entries
-
-    // dictionary entry structure
-    struct DictEntry {
-        QString str;
-        int code;
-        bool used;
-        DictEntry() : code(-1), used(false) {}
-    };
-
-    DictEntry dictionary[4096];         // for compression
-    QString reverseDictionary[4096];    // for decompression
-
-    void initDictionary();  // setup initial 256 entries
-    int findInDictionary(const QString& s);
+    static const int MIN_BITS = 9;            // starting code width
+    static const int MIN_MAX_BITS = 12;       // allowed range for the max width
+    static const int MAX_MAX_BITS = 20;
+    static const int DEFAULT_MAX_BITS = 16;
+    static const int CLEAR_CODE = 256;        // start over with a fresh dictionary
+    static const int FIRST_CODE = 257;        // first code for a new string
+    static const int CHECK_GAP = 10000;       // input bytes between ratio checks
+    static const int HEADER_SIZE = 13;        // marker + width + original size
+    static const int LEGACY_DICT_SIZE = 4096; // old fixed 12 bit layout
+
+    int maxBits;  // widest code, dictionary holds 1 << maxBits entries
+
+    // compression dictionary: a string is its prefix code plus one byte,
+    // so (prefix, byte) -> code is all that needs to be looked up
+    int* hashKey;     // prefix << 8 | byte, -1 = empty slot
+    int* hashCode;    // code of that string
+    int hashSize;     // power of two, twice the largest dictionary
+    int hashBits;     // log2 of the part in use for this stream
+
+    // decompression dictionary, entry i is entryPrefix[i] plus entryLast[i]
+    int* entryPrefix;
+    unsigned char* entryLast;
+    int* entryLength;   // bytes in the whole string
+    int entryCapacity;
+
+    void allocHash();
+    void allocEntries(int count);  // also sets up the 256 single bytes
+    void clearHash(int bits);
+    int findSlot(int prefix, unsigned char ch);  // slot holding the pair or free slot
+
+    bool expandCode(int code, int& prev, int& nextCode, int maxCodes,
+                    unsigned char* out, qint64& pos, qint64 size);
+    QByteArray decompressCodes(const QByteArray& input);
+    QByteArray decompressLegacy(const QByteArray& input);
 
 public:
-    LZWCompressor() {}
-    ~LZWCompressor() {}
+    LZWCompressor();
+    ~LZWCompressor();
+
+    // widest code in bits (12-20), bigger dictionaries help large files
+    void setMaxBits(int bits);
+    int getMaxBits() const { return maxBits; }
 
     QByteArray compress(const QByteArray& input);
     QByteArray decompress(const QByteArray& input);
@@ -7,11 +7,24 @@
 #include "huffmancompressor.h"
 #include "rlecompressor.h"
 #include "lzwcompressor.h"
+#include "lz77compressor.h"
+#include "lzhuffmancompressor.h"
+#include "bwtcompressor.h"
+#include "autocompressor.h"
+#include "containercompressor.h"
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     huffmanComp = new HuffmanCompressor();
+    huffmanComp->setBlockSize(1 << 20);  // 1 MB blocks, coded on all cores
+    huffmanComp->setFourStreams(true);
     rleComp = new RLECompressor();
+    rleComp->setPackBits(true);  // literal runs, mixed files still gain
     lzwComp = new LZWCompressor();
+    lz77Comp = new LZ77Compressor();
+    lzHuffComp = new LZHuffmanCompressor();
+    bwtComp = new BWTCompressor();
+    autoComp = new AutoCompressor();
+    containerComp = new ContainerCompressor();
     setupUI();
 }
 
@@ -19,6 +32,11 @@ MainWindow::~MainWindow() {
     delete huffmanComp;
     delete rleComp;
     delete lzwComp;
+    delete lz77Comp;
+    delete lzHuffComp;
+    delete bwtComp;
+    delete autoComp;
+    delete containerComp;
 }
 
 void MainWindow::setupUI() {
@@ -242,6 +260,11 @@ void MainWindow::setupUI() {
     algorithmCombo->addItem("  🎯  Huffman Encoding - Optimal for text & varied data");
     algorithmCombo->addItem("  🔄  Run-Length Encoding (RLE) - Best for repetitive data");
     algorithmCombo->addItem("  📚  LZW Compression - Dictionary-based patterns");
+    algorithmCombo->addItem("  🔁  LZ77 Compression - Long-distance repeats");
+    algorithmCombo->addItem("  🧩  LZ77 + Huffman - Deflate-style, best ratio");
+    algorithmCombo->addItem("  🧱  BWT Block Sorting - bzip2-style, best for text");
+    algorithmCombo->addItem("  🔗  Huffman (order-1 context) - Codes follow the previous byte");
+    algorithmCombo->addItem("  🤖  Auto - Picks the algorithm from a sample of the file");
     algorithmCombo->setCursor(Qt::PointingHandCursor);
     algorithmCombo->setMinimumHeight(40);
     algorithmCombo->setMaximumHeight(40);
@@ -291,6 +314,32 @@ void MainWindow::setupUI() {
         );
     settingsLayout->addWidget(algorithmCombo);
 
+    // entropy coder for Huffman, LZ77 + Huffman and BWT, decompress finds it in the file
+    ransCheck = new QCheckBox("  Use rANS entropy coder (Huffman, LZ77 + Huffman, BWT)");
+    ransCheck->setCursor(Qt::PointingHandCursor);
+    ransCheck->setStyleSheet(
+        "QCheckBox {"
+        "   color: #ffffff;"
+        "   font-size: 13px;"
+        "   spacing: 8px;"
+        "   background: transparent;"
+        "   padding: 5px;"
+        "}"
+        "QCheckBox::indicator {"
+        "   width: 16px;"
+        "   height: 16px;"
+        "   background: rgba(255, 255, 255, 0.15);"
+        "   border: 2px solid rgba(255, 255, 255, 0.4);"
+        "   border-radius: 4px;"
+        "}"
+        "QCheckBox::indicator:checked {"
+        "   background: qlineargradient(x1:0, y1:0, x2:1, y2:1,"
+        "       stop:0 #00d4ff, stop:1 #0099cc);"
+        "   border: 2px solid #00d4ff;"
+        "}"
+        );
+    settingsLayout->addWidget(ransCheck);
+
     mainLayout->addWidget(settingsCard);
 
     // ========== PROCESS BUTTON ==========
@@ -424,6 +473,9 @@ void MainWindow::setupUI() {
     logOutput->append("<span style='color:#00ff88;'>✓</span> Huffman Encoding <span style='color:#666;'>(Binary optimal)</span>");
     logOutput->append("<span style='color:#00ff88;'>✓</span> Run-Length Encoding <span style='color:#666;'>(Repetition specialist)</span>");
     logOutput->append("<span style='color:#00ff88;'>✓</span> LZW Compression <span style='color:#666;'>(Pattern recognition)</span>");
+    logOutput->append("<span style='color:#00ff88;'>✓</span> LZ77 Compression <span style='color:#666;'>(Sliding window matches)</span>");
+    logOutput->append("<span style='color:#00ff88;'>✓</span> LZ77 + Huffman <span style='color:#666;'>(Deflate-style pipeline)</span>");
+    logOutput->append("<span style='color:#00ff88;'>✓</span> BWT Block Sorting <span style='color:#666;'>(bzip2-style pipeline)</span>");
     logOutput->append("<span style='color:#00d4ff;'>═══════════════════════════════════════════════</span>");
     logOutput->append("<span style='color:#ffaa00;'>⚡</span> <span style='color:#ffffff;'>Ready to process files...</span>\n");
 }
@@ -491,8 +543,9 @@ void MainWindow::processFile() {
         return;
     }
 
-    QByteArray fileData = inputFile.readAll();
-    inputFile.close();
+    // the file stays open and gets read as it's processed, so big
+    // files don't have to fit in memory
+    qint64 inputSize = inputFile.size();
 
     progressBar->setValue(20);
 
@@ -500,17 +553,17 @@ void MainWindow::processFile() {
     logOutput->append("<span style='color:#ffaa00;'>⚡</span> <span style='color:#ffffff;font-weight:bold;'>Processing Started...</span>");
 
     QString sizeStr;
-    if(fileData.size() < 1024) {
-        sizeStr = QString::number(fileData.size()) + " bytes";
-    } else if(fileData.size() < 1024 * 1024) {
-        sizeStr = QString::number(fileData.size() / 1024.0, 'f', 2) + " KB";
+    if(inputSize < 1024) {
+        sizeStr = QString::number(inputSize) + " bytes";
+    } else if(inputSize < 1024 * 1024) {
+        sizeStr = QString::number(inputSize / 1024.0, 'f', 2) + " KB";
     } else {
-        sizeStr = QString::number(fileData.size() / (1024.0 * 1024.0), 'f', 2) + " MB";
+        sizeStr = QString::number(inputSize / (1024.0 * 1024.0), 'f', 2) + " MB";
     }
 
     logOutput->append("<span style='color:#ffffff;'>📏 Original Size:</span> <span style='color:#00ff88;'>" + sizeStr + "</span>");
 
-    QByteArray result;
+    qint64 resultSize = 0;
     QString outputPath;
     int selectedAlgo = algorithmCombo->currentIndex();
     bool isCompress = compressRadio->isChecked();
@@ -522,37 +575,97 @@ void MainWindow::processFile() {
     try {
         if(isCompress) {
             logOutput->append("<span style='color:#00d4ff;'>🗜️  Operation:</span> <span style='color:#ffffff;'>Compression</span>");
+
+            bool rans = ransCheck->isChecked();
+            containerComp->setRansCoding(rans);
+            if(rans && (selectedAlgo == 0 || selectedAlgo == 4 || selectedAlgo == 5 || selectedAlgo == 6 || selectedAlgo == 7)) {
+                logOutput->append("<span style='color:#00ff88;'>🎲 Entropy coder:</span> <span style='color:#ffffff;'>rANS</span>");
+            }
+
+            // every algorithm writes the same container, so decompressing
+            // never depends on picking the right algorithm again
+            int codec = AutoCompressor::STORED;
             switch(selectedAlgo) {
             case 0:
                 logOutput->append("<span style='color:#00ff88;'>🎯 Algorithm:</span> <span style='color:#ffffff;'>Huffman Encoding</span>");
-                result = huffmanComp->compress(fileData);
+                codec = AutoCompressor::HUFFMAN;
                 outputPath = selectedFilePath + ".huff";
                 break;
             case 1:
                 logOutput->append("<span style='color:#00ff88;'>🔄 Algorithm:</span> <span style='color:#ffffff;'>Run-Length Encoding</span>");
-                result = rleComp->compress(fileData);
+                codec = AutoCompressor::RLE;
                 outputPath = selectedFilePath + ".rle";
-
-                if(result.size() >= 8 &&
-                    (unsigned char)result[0] == 0xFF &&
-                    (unsigned char)result[1] == 0xFF &&
-                    (unsigned char)result[2] == 0xFF &&
-                    (unsigned char)result[3] == 0xFF) {
-                    logOutput->append("<span style='color:#ffaa00;'>⚠️</span> <span style='color:#ffffff;'>No repetition detected - stored uncompressed</span>");
-                }
                 break;
             case 2:
                 logOutput->append("<span style='color:#00ff88;'>📚 Algorithm:</span> <span style='color:#ffffff;'>LZW Compression</span>");
-                result = lzwComp->compress(fileData);
+                codec = AutoCompressor::LZW;
                 outputPath = selectedFilePath + ".lzw";
                 break;
+            case 3:
+                logOutput->append("<span style='color:#00ff88;'>🔁 Algorithm:</span> <span style='color:#ffffff;'>LZ77 Compression</span>");
+                codec = AutoCompressor::LZ77;
+                outputPath = selectedFilePath + ".lz77";
+                break;
+            case 4:
+                logOutput->append("<span style='color:#00ff88;'>🧩 Algorithm:</span> <span style='color:#ffffff;'>LZ77 + Huffman Compression</span>");
+                codec = AutoCompressor::LZ_HUFFMAN;
+                outputPath = selectedFilePath + ".lzhf";
+                break;
+            case 5:
+                logOutput->append("<span style='color:#00ff88;'>🧱 Algorithm:</span> <span style='color:#ffffff;'>BWT Block Sorting Compression</span>");
+                codec = AutoCompressor::BWT;
+                outputPath = selectedFilePath + ".bwt";
+                break;
+            case 6:
+                logOutput->append("<span style='color:#00ff88;'>🔗 Algorithm:</span> <span style='color:#ffffff;'>Huffman Encoding (order-1 context)</span>");
+                codec = AutoCompressor::HUFFMAN_ORDER1;
+                outputPath = selectedFilePath + ".huff";
+                break;
+            case 7: {
+                logOutput->append("<span style='color:#00ff88;'>🤖 Algorithm:</span> <span style='color:#ffffff;'>Auto (picked per block)</span>");
+                QByteArray head = inputFile.peek(1 << 20);
+                SampleStats stats = AutoCompressor::analyze((const unsigned char*)head.constData(), head.size());
+                logOutput->append("<span style='color:#00d4ff;'>🔬 Sample:</span> <span style='color:#ffffff;'>" +
+                                  QString::number(stats.entropy, 'f', 2) + " bits/byte, " +
+                                  QString::number(stats.runFraction * 100, 'f', 0) + "% runs, " +
+                                  QString::number(stats.repeatFraction * 100, 'f', 0) + "% repeats</span>");
+                codec = ContainerCompressor::AUTO;
+                outputPath = selectedFilePath + ".auto";
+                break;
+            }
             }
 
-            if(result.isEmpty()) {
+            QFile outputFile(outputPath);
+            if(!outputFile.open(QIODevice::WriteOnly)) {
+                QMessageBox::critical(this, "Error", "Cannot write output file!");
+                logOutput->append("<span style='color:#ff6b6b;'>❌ ERROR: Cannot write output file!</span>");
+                progressBar->setVisible(false);
+                processBtn->setEnabled(true);
+                return;
+            }
+
+            bool ok = containerComp->compress(&inputFile, &outputFile, codec);
+            resultSize = outputFile.size();
+            outputFile.close();
+            if(!ok) {
+                outputFile.remove();
                 throw std::runtime_error("Compression failed");
             }
 
-            if(result.size() >= fileData.size()) {
+            if(codec == ContainerCompressor::AUTO) {
+                for(int c = 0; c < AutoCompressor::CODEC_COUNT; c++) {
+                    if(containerComp->getBlockCount(c) == 0) continue;
+                    logOutput->append("<span style='color:#00ff88;'>✓ Picked:</span> <span style='color:#ffffff;'>" +
+                                      QString(AutoCompressor::codecName(c)) + " for " +
+                                      QString::number(containerComp->getBlockCount(c)) + " block(s)</span>");
+                }
+            } else if(containerComp->getBlockCount(AutoCompressor::STORED) > 0) {
+                logOutput->append("<span style='color:#ffaa00;'>⚠️</span> <span style='color:#ffffff;'>" +
+                                  QString::number(containerComp->getBlockCount(AutoCompressor::STORED)) +
+                                  " block(s) didn't shrink - stored uncompressed</span>");
+            }
+
+            if(resultSize >= inputSize) {
                 logOutput->append("<span style='color:#ff6b6b;'>⚠️ WARNING:</span> <span style='color:#ffffff;'>Compressed ≥ Original size</span>");
             } else {
                 logOutput->append("<span style='color:#00ff88;'>✓ Compression successful!</span>");
@@ -572,6 +685,18 @@ void MainWindow::processFile() {
             } else if(basePath.endsWith(".lzw")) {
                 basePath = basePath.left(basePath.length() - 4);
                 outputPath = basePath;
+            } else if(basePath.endsWith(".lz77")) {
+                basePath = basePath.left(basePath.length() - 5);
+                outputPath = basePath;
+            } else if(basePath.endsWith(".lzhf")) {
+                basePath = basePath.left(basePath.length() - 5);
+                outputPath = basePath;
+            } else if(basePath.endsWith(".bwt")) {
+                basePath = basePath.left(basePath.length() - 4);
+                outputPath = basePath;
+            } else if(basePath.endsWith(".auto")) {
+                basePath = basePath.left(basePath.length() - 5);
+                outputPath = basePath;
             } else {
                 outputPath = selectedFilePath + ".decompressed";
             }
@@ -588,28 +713,84 @@ void MainWindow::processFile() {
                 }
             }
 
-            switch(selectedAlgo) {
-            case 0:
-                logOutput->append("<span style='color:#00ff88;'>🎯 Algorithm:</span> <span style='color:#ffffff;'>Huffman Decoding</span>");
-                result = huffmanComp->decompress(fileData);
-                break;
-            case 1:
-                logOutput->append("<span style='color:#00ff88;'>🔄 Algorithm:</span> <span style='color:#ffffff;'>RLE Decompression</span>");
-                result = rleComp->decompress(fileData);
-                break;
-            case 2:
-                logOutput->append("<span style='color:#00ff88;'>📚 Algorithm:</span> <span style='color:#ffffff;'>LZW Decompression</span>");
-                result = lzwComp->decompress(fileData);
-                break;
+            QFile outputFile(outputPath);
+            if(!outputFile.open(QIODevice::WriteOnly)) {
+                QMessageBox::critical(this, "Error", "Cannot write output file!");
+                logOutput->append("<span style='color:#ff6b6b;'>❌ ERROR: Cannot write output file!</span>");
+                progressBar->setVisible(false);
+                processBtn->setEnabled(true);
+                return;
             }
 
-            if(result.isEmpty()) {
+            // containers and auto files say what they need, whatever the
+            // combo is set to. Only the older layouts go by the combo
+            bool ok = false;
+            QByteArray header = inputFile.peek(ContainerCompressor::HEADER_SIZE);
+            if(header.size() == ContainerCompressor::HEADER_SIZE &&
+               ContainerCompressor::checkHeader((const unsigned char*)header.constData())) {
+                int codec = (unsigned char)header[5];
+                QString name = (codec == ContainerCompressor::AUTO) ? QString("Auto") : QString(AutoCompressor::codecName(codec));
+                logOutput->append("<span style='color:#00ff88;'>📦 Container:</span> <span style='color:#ffffff;'>" + name + " (detected)</span>");
+                ok = containerComp->decompress(&inputFile, &outputFile);
+            } else {
+                // the older layouts need the whole file at once
+                QByteArray fileData = inputFile.readAll();
+                QByteArray result;
+                if(AutoCompressor::isAutoStream(fileData)) {
+                    selectedAlgo = 7;
+                }
+
+                switch(selectedAlgo) {
+                case 0:
+                    logOutput->append("<span style='color:#00ff88;'>🎯 Algorithm:</span> <span style='color:#ffffff;'>Huffman Decoding</span>");
+                    result = huffmanComp->decompress(fileData);
+                    break;
+                case 1:
+                    logOutput->append("<span style='color:#00ff88;'>🔄 Algorithm:</span> <span style='color:#ffffff;'>RLE Decompression</span>");
+                    result = rleComp->decompress(fileData);
+                    break;
+                case 2:
+                    logOutput->append("<span style='color:#00ff88;'>📚 Algorithm:</span> <span style='color:#ffffff;'>LZW Decompression</span>");
+                    result = lzwComp->decompress(fileData);
+                    break;
+                case 3:
+                    logOutput->append("<span style='color:#00ff88;'>🔁 Algorithm:</span> <span style='color:#ffffff;'>LZ77 Decompression</span>");
+                    result = lz77Comp->decompress(fileData);
+                    break;
+                case 4:
+                    logOutput->append("<span style='color:#00ff88;'>🧩 Algorithm:</span> <span style='color:#ffffff;'>LZ77 + Huffman Decompression</span>");
+                    result = lzHuffComp->decompress(fileData);
+                    break;
+                case 5:
+                    logOutput->append("<span style='color:#00ff88;'>🧱 Algorithm:</span> <span style='color:#ffffff;'>BWT Block Sorting Decompression</span>");
+                    result = bwtComp->decompress(fileData);
+                    break;
+                case 6:
+                    // the block flags say which mode was used
+                    logOutput->append("<span style='color:#00ff88;'>🔗 Algorithm:</span> <span style='color:#ffffff;'>Huffman Decoding (order-1 context)</span>");
+                    result = huffmanComp->decompress(fileData);
+                    break;
+                case 7:
+                    result = autoComp->decompress(fileData);
+                    logOutput->append("<span style='color:#00ff88;'>🤖 Algorithm:</span> <span style='color:#ffffff;'>Auto (" +
+                                      QString(AutoCompressor::codecName(autoComp->getLastCodec())) + ")</span>");
+                    break;
+                }
+
+                ok = !result.isEmpty() && outputFile.write(result) == result.size();
+            }
+
+            resultSize = outputFile.size();
+            outputFile.close();
+            if(!ok) {
+                outputFile.remove();
                 throw std::runtime_error("Decompression failed");
             }
 
             logOutput->append("<span style='color:#00d4ff;'>💾 Restoring to:</span> <span style='color:#ffffff;'>" + outputPath.split("/").last() + "</span>");
         }
     } catch(...) {
+        inputFile.close();
         QMessageBox::critical(this, "Error", "Processing failed!");
         progressBar->setVisible(false);
         processBtn->setEnabled(true);
@@ -622,112 +803,105 @@ void MainWindow::processFile() {
     QDateTime endTime = QDateTime::currentDateTime();
     qint64 elapsedMs = startTime.msecsTo(endTime);
 
-    QFile outputFile(outputPath);
-    if(outputFile.open(QIODevice::WriteOnly)) {
-        outputFile.write(result);
-        outputFile.close();
+    inputFile.close();
 
-        progressBar->setValue(100);
+    progressBar->setValue(100);
 
-        QString resultSizeStr;
-        if(result.size() < 1024) {
-            resultSizeStr = QString::number(result.size()) + " bytes";
-        } else if(result.size() < 1024 * 1024) {
-            resultSizeStr = QString::number(result.size() / 1024.0, 'f', 2) + " KB";
-        } else {
-            resultSizeStr = QString::number(result.size() / (1024.0 * 1024.0), 'f', 2) + " MB";
-        }
+    QString resultSizeStr;
+    if(resultSize < 1024) {
+        resultSizeStr = QString::number(resultSize) + " bytes";
+    } else if(resultSize < 1024 * 1024) {
+        resultSizeStr = QString::number(resultSize / 1024.0, 'f', 2) + " KB";
+    } else {
+        resultSizeStr = QString::number(resultSize / (1024.0 * 1024.0), 'f', 2) + " MB";
+    }
 
-        logOutput->append("<span style='color:#ffffff;'>📦 Output Size:</span> <span style='color:#00ff88;'>" + resultSizeStr + "</span>");
-
-        if(isCompress && fileData.size() > 0) {
-            double ratio = 100.0 * result.size() / fileData.size();
-            logOutput->append("<span style='color:#ffffff;'>📊 Compression Ratio:</span> <span style='color:#00d4ff;'>" +
-                              QString::number(ratio, 'f', 2) + "%</span>");
-
-            qint64 saved = fileData.size() - result.size();
-            if(saved > 0) {
-                QString savedStr;
-                if(saved < 1024) {
-                    savedStr = QString::number(saved) + " bytes";
-                } else if(saved < 1024 * 1024) {
-                    savedStr = QString::number(saved / 1024.0, 'f', 2) + " KB";
-                } else {
-                    savedStr = QString::number(saved / (1024.0 * 1024.0), 'f', 2) + " MB";
-                }
+    logOutput->append("<span style='color:#ffffff;'>📦 Output Size:</span> <span style='color:#00ff88;'>" + resultSizeStr + "</span>");
+
+    if(isCompress && inputSize > 0) {
+        double ratio = 100.0 * resultSize / inputSize;
+        logOutput->append("<span style='color:#ffffff;'>📊 Compression Ratio:</span> <span style='color:#00d4ff;'>" +
+                          QString::number(ratio, 'f', 2) + "%</span>");
 
-                logOutput->append("<span style='color:#00ff88;'>💾 Space Saved:</span> <span style='color:#00ff88;'>" +
-                                  savedStr + " (" + QString::number(100.0 * saved / fileData.size(), 'f', 1) + "%)</span>");
+        qint64 saved = inputSize - resultSize;
+        if(saved > 0) {
+            QString savedStr;
+            if(saved < 1024) {
+                savedStr = QString::number(saved) + " bytes";
+            } else if(saved < 1024 * 1024) {
+                savedStr = QString::number(saved / 1024.0, 'f', 2) + " KB";
             } else {
-                logOutput->append("<span style='color:#ff6b6b;'>📈 Space Lost:</span> <span style='color:#ff6b6b;'>" +
-                                  QString::number(-saved) + " bytes</span>");
+                savedStr = QString::number(saved / (1024.0 * 1024.0), 'f', 2) + " MB";
             }
-        }
-
-        logOutput->append("<span style='color:#ffffff;'>⏱️  Processing Time:</span> <span style='color:#00d4ff;'>" +
-                          QString::number(elapsedMs) + " ms</span>");
-        logOutput->append("<span style='color:#00ff88;'>✓ Output saved:</span> <span style='color:#ffffff;'>" +
-                          outputPath + "</span>");
-        logOutput->append("<span style='color:#00d4ff;font-weight:bold;'>═══════════════════════════════════════════════</span>");
-        logOutput->append("<span style='color:#00ff88;font-weight:bold;'>✓ Processing Complete!</span>\n");
-
-        QString statusMsg;
 
-        if(isCompress) {
-            statusMsg = QString("✅ File Compressed Successfully!\n\n"
-                                "📏 Original: %1\n"
-                                "📦 Compressed: %2\n"
-                                "⏱️  Time: %3 ms\n\n"
-                                "⚠️  Note: Compressed file is binary format.\n"
-                                "Use 'Decompress' to restore original.\n\n"
-                                "💾 Saved to:\n%4")
-                            .arg(sizeStr)
-                            .arg(resultSizeStr)
-                            .arg(elapsedMs)
-                            .arg(outputPath);
+            logOutput->append("<span style='color:#00ff88;'>💾 Space Saved:</span> <span style='color:#00ff88;'>" +
+                              savedStr + " (" + QString::number(100.0 * saved / inputSize, 'f', 1) + "%)</span>");
         } else {
-            statusMsg = QString("✅ File Decompressed Successfully!\n\n"
-                                "📦 Compressed: %1\n"
-                                "📄 Restored: %2\n"
-                                "⏱️  Time: %3 ms\n\n"
-                                "✓ File can now be opened normally!\n\n"
-                                "💾 Saved to:\n%4")
-                            .arg(sizeStr)
-                            .arg(resultSizeStr)
-                            .arg(elapsedMs)
-                            .arg(outputPath);
+            logOutput->append("<span style='color:#ff6b6b;'>📈 Space Lost:</span> <span style='color:#ff6b6b;'>" +
+                              QString::number(-saved) + " bytes</span>");
         }
+    }
 
-        QMessageBox msgBox(this);
-        msgBox.setWindowTitle("Success!");
-        msgBox.setText(statusMsg);
-        msgBox.setIcon(QMessageBox::Information);
-        msgBox.setStyleSheet(
-            "QMessageBox {"
-            "   background: #16213e;"
-            "}"
-            "QMessageBox QLabel {"
-            "   color: #ffffff;"
-            "   font-size: 13px;"
-            "}"
-            "QPushButton {"
-            "   background: #00d4ff;"
-            "   color: white;"
-            "   border: none;"
-            "   padding: 8px 20px;"
-            "   border-radius: 5px;"
-            "   font-weight: bold;"
-            "}"
-            "QPushButton:hover {"
-            "   background: #00e5ff;"
-            "}"
-            );
-        msgBox.exec();
+    logOutput->append("<span style='color:#ffffff;'>⏱️  Processing Time:</span> <span style='color:#00d4ff;'>" +
+                      QString::number(elapsedMs) + " ms</span>");
+    logOutput->append("<span style='color:#00ff88;'>✓ Output saved:</span> <span style='color:#ffffff;'>" +
+                      outputPath + "</span>");
+    logOutput->append("<span style='color:#00d4ff;font-weight:bold;'>═══════════════════════════════════════════════</span>");
+    logOutput->append("<span style='color:#00ff88;font-weight:bold;'>✓ Processing Complete!</span>\n");
+
+    QString statusMsg;
+
+    if(isCompress) {
+        statusMsg = QString("✅ File Compressed Successfully!\n\n"
+                            "📏 Original: %1\n"
+                            "📦 Compressed: %2\n"
+                            "⏱️  Time: %3 ms\n\n"
+                            "⚠️  Note: Compressed file is binary format.\n"
+                            "Use 'Decompress' to restore original.\n\n"
+                            "💾 Saved to:\n%4")
+                        .arg(sizeStr)
+                        .arg(resultSizeStr)
+                        .arg(elapsedMs)
+                        .arg(outputPath);
     } else {
-        QMessageBox::critical(this, "Error", "Cannot write output file!");
-        logOutput->append("<span style='color:#ff6b6b;'>❌ ERROR: Cannot write output file!</span>");
+        statusMsg = QString("✅ File Decompressed Successfully!\n\n"
+                            "📦 Compressed: %1\n"
+                            "📄 Restored: %2\n"
+                            "⏱️  Time: %3 ms\n\n"
+                            "✓ File can now be opened normally!\n\n"
+                            "💾 Saved to:\n%4")
+                        .arg(sizeStr)
+                        .arg(resultSizeStr)
+                        .arg(elapsedMs)
+                        .arg(outputPath);
     }
 
+    QMessageBox msgBox(this);
+    msgBox.setWindowTitle("Success!");
+    msgBox.setText(statusMsg);
+    msgBox.setIcon(QMessageBox::Information);
+    msgBox.setStyleSheet(
+        "QMessageBox {"
+        "   background: #16213e;"
+        "}"
+        "QMessageBox QLabel {"
+        "   color: #ffffff;"
+        "   font-size: 13px;"
+        "}"
+        "QPushButton {"
+        "   background: #00d4ff;"
+        "   color: white;"
+        "   border: none;"
+        "   padding: 8px 20px;"
+        "   border-radius: 5px;"
+        "   font-weight: bold;"
+        "}"
+        "QPushButton:hover {"
+        "   background: #00e5ff;"
+        "}"
+        );
+    msgBox.exec();
+
     progressBar->setVisible(false);
     processBtn->setEnabled(true);
 }
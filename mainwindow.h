@@ -6,6 +6,7 @@
 #include <QLabel>
 #include <QComboBox>
 #include <QRadioButton>
+#include <QCheckBox>
 #include <QProgressBar>
 #include <QTextEdit>
 #include <QVBoxLayout>
@@ -13,6 +14,11 @@
 #include "huffmancompressor.h"
 #include "rlecompressor.h"
 #include "lzwcompressor.h"
+#include "lz77compressor.h"
+#include "lzhuffmancompressor.h"
+#include "bwtcompressor.h"
+#include "autocompressor.h"
+#include "containercompressor.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -27,6 +33,7 @@ private:
     QRadioButton* decompressRadio;
     QGroupBox* algorithmGroup;
     QComboBox* algorithmCombo;
+    QCheckBox* ransCheck;
     QPushButton* processBtn;
     QProgressBar* progressBar;
     QTextEdit* logOutput;
@@ -35,6 +42,11 @@ private:
     HuffmanCompressor* huffmanComp;
     RLECompressor* rleComp;
     LZWCompressor* lzwComp;
+    LZ77Compressor* lz77Comp;
+    LZHuffmanCompressor* lzHuffComp;
+    BWTCompressor* bwtComp;
+    AutoCompressor* autoComp;
+    ContainerCompressor* containerComp;
 
     void setupUI();
     void connectSignals();
@@ -0,0 +1,253 @@
+#include "ranscoder.h"
+#include <cstring>
+
+RANSCoder::RANSCoder() {
+    memset(freqs, 0, sizeof(freqs));
+    memset(starts, 0, sizeof(starts));
+    memset(slots, 0, sizeof(slots));
+}
+
+void RANSCoder::buildSlots() {
+    int start = 0;
+    for(int c = 0; c < 256; c++) {
+        starts[c] = (quint16)start;
+        for(int k = 0; k < freqs[c]; k++) {
+            slots[start + k] = (quint32)c | ((quint32)(freqs[c] - 1) << 8) | ((quint32)k << 20);
+        }
+        start += freqs[c];
+    }
+}
+
+bool RANSCoder::buildFromCounts(const unsigned long long* counts) {
+    unsigned long long total = 0;
+    int biggest = -1;
+    for(int c = 0; c < 256; c++) {
+        total += counts[c];
+        if(counts[c] && (biggest < 0 || counts[c] > counts[biggest])) biggest = c;
+    }
+    if(total == 0) return false;
+
+    // scale down, rare symbols are rounded up to 1
+    int sum = 0;
+    for(int c = 0; c < 256; c++) {
+        if(counts[c] == 0) {
+            freqs[c] = 0;
+            continue;
+        }
+        unsigned long long f = (unsigned long long)((double)counts[c] * TOTAL / (double)total);
+        if(f < 1) f = 1;
+        if(f > TOTAL) f = TOTAL;
+        freqs[c] = (quint16)f;
+        sum += (int)f;
+    }
+
+    // the rounding error goes to (or comes from) the biggest symbols,
+    // where it changes the cost per symbol the least
+    if(sum < TOTAL) {
+        freqs[biggest] += (quint16)(TOTAL - sum);
+    }
+    while(sum > TOTAL) {
+        int top = 0;
+        for(int c = 1; c < 256; c++) {
+            if(freqs[c] > freqs[top]) top = c;
+        }
+        int take = freqs[top] / 8;
+        if(take < 1) take = 1;
+        if(take > sum - TOTAL) take = sum - TOTAL;
+        freqs[top] -= (quint16)take;
+        sum -= take;
+    }
+
+    buildSlots();
+    return true;
+}
+
+void RANSCoder::writeTable(QByteArray& output) const {
+    int used = 0;
+    for(int c = 0; c < 256; c++) {
+        if(freqs[c]) used++;
+    }
+    output.append((char)(used - 1));
+
+    if(used < 32) {
+        for(int c = 0; c < 256; c++) {
+            if(freqs[c]) output.append((char)c);
+        }
+    } else {
+        for(int i = 0; i < 32; i++) {
+            unsigned char bits = 0;
+            for(int b = 0; b < 8; b++) {
+                if(freqs[i * 8 + b]) bits |= (unsigned char)(1 << b);
+            }
+            output.append((char)bits);
+        }
+    }
+
+    // frequency - 1 in one byte below 128, else two
+    int written = 0;
+    for(int c = 0; c < 256 && written < used - 1; c++) {
+        if(!freqs[c]) continue;
+        int f = freqs[c] - 1;
+        if(f < 128) {
+            output.append((char)f);
+        } else {
+            output.append((char)(0x80 | (f >> 8)));
+            output.append((char)(f & 0xFF));
+        }
+        written++;
+    }
+}
+
+bool RANSCoder::readTable(const QByteArray& data, int& pos) {
+    const unsigned char* in = (const unsigned char*)data.constData();
+    int size = data.size();
+
+    if(pos >= size) return false;
+    int used = in[pos++] + 1;
+
+    memset(freqs, 0, sizeof(freqs));
+    unsigned char symbols[256];
+    if(used < 32) {
+        if(size - pos < used) return false;
+        for(int i = 0; i < used; i++) {
+            symbols[i] = in[pos + i];
+            if(i > 0 && symbols[i] <= symbols[i - 1]) return false;
+        }
+        pos += used;
+    } else {
+        if(size - pos < 32) return false;
+        int found = 0;
+        for(int c = 0; c < 256; c++) {
+            if(in[pos + c / 8] & (1 << (c % 8))) {
+                if(found == used) return false;
+                symbols[found++] = (unsigned char)c;
+            }
+        }
+        pos += 32;
+        if(found != used) return false;
+    }
+
+    int sum = 0;
+    for(int i = 0; i < used - 1; i++) {
+        if(pos >= size) return false;
+        int f = in[pos++];
+        if(f & 0x80) {
+            if(pos >= size) return false;
+            f = ((f & 0x7F) << 8) | in[pos++];
+        }
+        f += 1;
+        sum += f;
+        if(sum >= TOTAL) return false;   // the last symbol needs at least 1
+        freqs[symbols[i]] = (quint16)f;
+    }
+    freqs[symbols[used - 1]] = (quint16)(TOTAL - sum);
+
+    buildSlots();
+    return true;
+}
+
+// Layout: 4 states, then the renormalization words
+bool RANSCoder::encode(const unsigned char* data, int size, QByteArray& output) const {
+    for(int i = 0; i < size; i++) {
+        if(!freqs[data[i]]) return false;
+    }
+
+    RANSEncoder encoder(size);
+    for(int i = size - 1; i >= 0; i--) {
+        encoder.put(*this, data[i], i & (LANES - 1));
+    }
+    encoder.finish(output);
+    return true;
+}
+
+// one step of one lane without bounds checks, the caller makes sure
+// 2 bytes are left. the word is read either way so it's a select, not a branch
+static inline unsigned char decodeStep(const quint32* slots, quint32& x, const unsigned char*& src) {
+    quint32 entry = slots[x & (RANSCoder::TOTAL - 1)];
+    x = (((entry >> 8) & 0xFFF) + 1) * (x >> RANSCoder::SCALE_BITS) + (entry >> 20);
+    quint32 word = qFromLittleEndian<quint16>(src);
+    bool renorm = x < RANSCoder::LOWER;
+    x = renorm ? (x << 16) | word : x;
+    src += renorm ? 2 : 0;
+    return (unsigned char)(entry & 0xFF);
+}
+
+bool RANSCoder::decode(const unsigned char* src, int srcSize, unsigned char* dst, int dstSize) const {
+    if(srcSize < 4 * LANES) return false;
+    const unsigned char* end = src + srcSize;
+
+    quint32 x0 = qFromLittleEndian<quint32>(src);
+    quint32 x1 = qFromLittleEndian<quint32>(src + 4);
+    quint32 x2 = qFromLittleEndian<quint32>(src + 8);
+    quint32 x3 = qFromLittleEndian<quint32>(src + 12);
+    src += 4 * LANES;
+
+    // one symbol per lane per round, the four chains don't wait on each
+    // other. a round reads at most 8 bytes, so only the last few need checks
+    int i = 0;
+    while(i + LANES <= dstSize && end - src >= 2 * LANES) {
+        dst[i] = decodeStep(slots, x0, src);
+        dst[i + 1] = decodeStep(slots, x1, src);
+        dst[i + 2] = decodeStep(slots, x2, src);
+        dst[i + 3] = decodeStep(slots, x3, src);
+        i += LANES;
+    }
+
+    // the rest with the checked decoder
+    unsigned char states[4 * LANES];
+    qToLittleEndian<quint32>(x0, states);
+    qToLittleEndian<quint32>(x1, states + 4);
+    qToLittleEndian<quint32>(x2, states + 8);
+    qToLittleEndian<quint32>(x3, states + 12);
+    RANSDecoder decoder(states, sizeof(states));
+    decoder.resume(src, end);
+    for(; i < dstSize; i++) {
+        dst[i] = (unsigned char)decoder.get(*this, i & (LANES - 1));
+    }
+
+    return decoder.finished();
+}
+
+RANSEncoder::RANSEncoder(int symbolCount) {
+    qint64 capacity = 2LL * symbolCount + 4 * RANSCoder::LANES;
+    buffer = new unsigned char[capacity];
+    end = buffer + capacity;
+    ptr = end;
+    for(int k = 0; k < RANSCoder::LANES; k++) state[k] = RANSCoder::LOWER;
+}
+
+int RANSEncoder::finish(QByteArray& output) {
+    // lane 0 ends up first, where the decoder looks for it
+    for(int k = RANSCoder::LANES - 1; k >= 0; k--) {
+        ptr -= 4;
+        qToLittleEndian<quint32>(state[k], ptr);
+    }
+    int bytes = (int)(end - ptr);
+    output.append(QByteArray::fromRawData((const char*)ptr, bytes));
+
+    // ready for another run
+    ptr = end;
+    for(int k = 0; k < RANSCoder::LANES; k++) state[k] = RANSCoder::LOWER;
+    return bytes;
+}
+
+RANSDecoder::RANSDecoder(const unsigned char* data, qint64 size)
+    : src(data), end(data + size), overrun(false) {
+    for(int k = 0; k < RANSCoder::LANES; k++) {
+        if(end - src >= 4) {
+            state[k] = qFromLittleEndian<quint32>(src);
+            src += 4;
+        } else {
+            state[k] = RANSCoder::LOWER;
+            overrun = true;
+        }
+    }
+}
+
+bool RANSDecoder::finished() const {
+    if(overrun || src != end) return false;
+    for(int k = 0; k < RANSCoder::LANES; k++) {
+        if(state[k] != RANSCoder::LOWER) return false;
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef RANSCODER_H
+#define RANSCODER_H
+
+#include <QByteArray>
+#include <QtEndian>
+
+// Table based rANS (asymmetric numeral systems) for one alphabet of up
+// to 256 symbols. Counts are scaled to 12 bit frequencies, so a symbol
+// costs log2(4096 / freq) bits and skewed data doesn't pay huffman's
+// whole bit per symbol. 32 bit states that move 16 bits at a time (at
+// most once per symbol, so decoding needs no loop), 4 states interleaved
+// so decoding has no long dependency chain
+class RANSCoder {
+    friend class RANSEncoder;
+    friend class RANSDecoder;
+
+public:
+    static const int SCALE_BITS = 12;
+    static const int TOTAL = 1 << SCALE_BITS;   // frequencies add up to this
+    static const int LANES = 4;                 // interleaved states
+    static const quint32 LOWER = 1u << 16;      // states stay in [LOWER, LOWER << 16)
+
+private:
+    quint16 freqs[256];    // normalized frequency, 0 = not in the alphabet
+    quint16 starts[256];   // sum of the frequencies before each symbol
+    // decode: everything about the symbol owning a slot in one word,
+    // symbol | (freq - 1) << 8 | (slot - start) << 20
+    quint32 slots[TOTAL];
+
+    void buildSlots();
+
+public:
+    RANSCoder();
+
+    // scale a histogram (e.g. FrequencyTable::rawCounts) down to TOTAL,
+    // every symbol with a count keeps a frequency of at least 1
+    bool buildFromCounts(const unsigned long long* counts);
+    int symbolFreq(int symbol) const { return freqs[symbol]; }
+
+    // compact header: symbol count, then the symbols as a list or a
+    // bitmap (whichever is smaller), then 1-2 bytes per frequency with
+    // the last one left out since they add up to TOTAL
+    void writeTable(QByteArray& output) const;
+    bool readTable(const QByteArray& data, int& pos);
+
+    // one order 0 run of bytes, coded with this table
+    bool encode(const unsigned char* data, int size, QByteArray& output) const;
+    bool decode(const unsigned char* src, int srcSize, unsigned char* dst, int dstSize) const;
+};
+
+// Codes symbols with any mix of tables. rANS works like a stack, so the
+// symbols have to be put in reverse order, the decoder gets them forwards
+// Symbol i goes to lane i % LANES on both sides
+class RANSEncoder {
+private:
+    unsigned char* buffer;
+    unsigned char* end;
+    unsigned char* ptr;    // output grows down from end
+    quint32 state[RANSCoder::LANES];
+
+public:
+    // at most one 16 bit word comes out per symbol
+    RANSEncoder(int symbolCount);
+    ~RANSEncoder() { delete[] buffer; }
+
+    void put(const RANSCoder& model, int symbol, int lane) {
+        quint32 freq = model.freqs[symbol];
+        quint32 x = state[lane];
+        // 64 bits, a lone symbol (freq = TOTAL) would wrap to 0
+        quint64 xMax = ((quint64)(RANSCoder::LOWER >> RANSCoder::SCALE_BITS) << 16) * freq;
+        if(x >= xMax) {
+            ptr -= 2;
+            qToLittleEndian<quint16>((quint16)(x & 0xFFFF), ptr);
+            x >>= 16;
+        }
+        state[lane] = ((x / freq) << RANSCoder::SCALE_BITS) + (x % freq) + model.starts[symbol];
+    }
+
+    // store the states in front and append everything, returns the byte count
+    int finish(QByteArray& output);
+};
+
+class RANSDecoder {
+private:
+    const unsigned char* src;
+    const unsigned char* end;
+    quint32 state[RANSCoder::LANES];
+    bool overrun;   // ran past the end, the data is broken
+
+public:
+    RANSDecoder(const unsigned char* data, qint64 size);
+
+    // keep the states, read the rest of the bytes from somewhere else
+    void resume(const unsigned char* data, const unsigned char* dataEnd) {
+        src = data;
+        end = dataEnd;
+    }
+
+    int get(const RANSCoder& model, int lane) {
+        quint32 x = state[lane];
+        quint32 entry = model.slots[x & (RANSCoder::TOTAL - 1)];
+        x = (((entry >> 8) & 0xFFF) + 1) * (x >> RANSCoder::SCALE_BITS) + (entry >> 20);
+        if(x < RANSCoder::LOWER) {
+            if(end - src < 2) {
+                overrun = true;
+                x = RANSCoder::LOWER;
+            } else {
+                x = (x << 16) | qFromLittleEndian<quint16>(src);
+                src += 2;
+            }
+        }
+        state[lane] = x;
+        return (int)(entry & 0xFF);
+    }
+
+    // every state back where the encoder started and all bytes used
+    bool finished() const;
+};
+
+#endif // RANSCODER_H
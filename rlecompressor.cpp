@@ -1,23 +1,129 @@
 #include "rlecompressor.h"
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RLE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Run scanning: how many bytes from p on equal p[0], looking at no more
+// than limit bytes. Picked once at startup for the cpu we run on
+
+#ifndef RLE_X86
+// portable version, 8 bytes per step, first differing byte is the
+// lowest set bit of the xor once the word is read little endian
+static int runLengthScalar(const unsigned char* p, int limit) {
+    quint64 pattern = p[0] * 0x0101010101010101ULL;
+    int n = 0;
+    while(n + 8 <= limit) {
+        quint64 diff = qFromLittleEndian<quint64>(p + n) ^ pattern;
+        if(diff) return n + (int)(qCountTrailingZeroBits(diff) >> 3);
+        n += 8;
+    }
+    while(n < limit && p[n] == p[0]) n++;
+    return n;
+}
+#else
+// Qt 5 needs SSE2 on x86 anyway, so this one is always there
+static int runLengthSSE2(const unsigned char* p, int limit) {
+    if(limit < 2 || p[1] != p[0]) return 1;  // most runs are one byte
+    __m128i pattern = _mm_set1_epi8((char)p[0]);
+    int n = 0;
+    while(n + 16 <= limit) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + n));
+        unsigned int same = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern));
+        if(same != 0xFFFF) return n + (int)qCountTrailingZeroBits(~same);
+        n += 16;
+    }
+    if(limit >= 16 && n < limit) {
+        // last 16 bytes, overlapping what was already checked
+        int start = limit - 16;
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + start));
+        unsigned int same = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern));
+        same |= (1u << (n - start)) - 1;
+        return (same == 0xFFFF) ? limit : start + (int)qCountTrailingZeroBits(~same);
+    }
+    while(n < limit && p[n] == p[0]) n++;
+    return n;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static int runLengthAVX2(const unsigned char* p, int limit) {
+    if(limit < 2 || p[1] != p[0]) return 1;  // most runs are one byte
+    __m256i pattern = _mm256_set1_epi8((char)p[0]);
+    int n = 0;
+    while(n + 32 <= limit) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + n));
+        unsigned int same = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern));
+        if(same != 0xFFFFFFFFu) return n + (int)qCountTrailingZeroBits(~same);
+        n += 32;
+    }
+    if(limit >= 32 && n < limit) {
+        // last 32 bytes, overlapping what was already checked
+        int start = limit - 32;
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + start));
+        unsigned int same = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern));
+        same |= (1u << (n - start)) - 1;
+        return (same == 0xFFFFFFFFu) ? limit : start + (int)qCountTrailingZeroBits(~same);
+    }
+    while(n < limit && p[n] == p[0]) n++;
+    return n;
+}
+
+static bool cpuHasAVX2() {
+#if defined(_MSC_VER)
+    // cpu has to support it and the OS has to save the ymm registers
+    int info[4];
+    __cpuid(info, 1);
+    bool osSaves = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                   ((_xgetbv(0) & 6) == 6);
+    if(!osSaves) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // runs from a static initializer, possibly before libgcc set up
+    // the cpu model that __builtin_cpu_supports reads
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+typedef int (*RunLengthFunc)(const unsigned char* p, int limit);
+
+static RunLengthFunc pickRunLength() {
+#ifdef RLE_X86
+    if(cpuHasAVX2()) return runLengthAVX2;
+    return runLengthSSE2;
+#else
+    return runLengthScalar;
+#endif
+}
+
+static const RunLengthFunc runLength = pickRunLength();
 
 QByteArray RLECompressor::compress(const QByteArray& input) {
     if(input.isEmpty()) return QByteArray();
+    if(packBits) return compressPackBits(input);
 
-    // check if compression is worth it
+    const unsigned char* data = (const unsigned char*)input.constData();
+    int n = input.size();
+
+    // check if compression is worth it, one pair per 255 bytes of a run
     int estimatedSize = 0;
     int i = 0;
-    while(i < input.size()) {
-        unsigned char current = input[i];
-        int count = 1;
-
-        while(i + count < input.size() &&
-               input[i + count] == current &&
-               count < 255) {
-            count++;
-        }
-
-        estimatedSize += 2;  // char + count
-        i += count;
+    while(i < n) {
+        int run = runLength(data + i, n - i);
+        estimatedSize += 2 * ((run + 254) / 255);  // char + count
+        i += run;
+        if(estimatedSize >= n) break;  // no need to look further
     }
 
     // if compression makes it bigger, store uncompressed
@@ -39,39 +145,169 @@ QByteArray RLECompressor::compress(const QByteArray& input) {
         return result;
     }
 
-    QByteArray result;
+    // size is known exactly now
+    QByteArray result(4 + estimatedSize, 0);
+    unsigned char* out = (unsigned char*)result.data();
 
     // write original size (4 bytes)
     int origSize = input.size();
-    result.append((char)(origSize & 0xFF));
-    result.append((char)((origSize >> 8) & 0xFF));
-    result.append((char)((origSize >> 16) & 0xFF));
-    result.append((char)((origSize >> 24) & 0xFF));
+    out[0] = (unsigned char)(origSize & 0xFF);
+    out[1] = (unsigned char)((origSize >> 8) & 0xFF);
+    out[2] = (unsigned char)((origSize >> 16) & 0xFF);
+    out[3] = (unsigned char)((origSize >> 24) & 0xFF);
+    out += 4;
 
     // compress: write char and count pairs
     i = 0;
-    while(i < input.size()) {
-        unsigned char current = input[i];
-        int count = 1;
-
-        // count consecutive same characters
-        while(i + count < input.size() &&
-               input[i + count] == current &&
-               count < 255) {
-            count++;
+    while(i < n) {
+        unsigned char current = data[i];
+        int run = runLength(data + i, n - i);
+        i += run;
+
+        // long runs are split into pieces of 255
+        while(run > 0) {
+            int count = (run < 255) ? run : 255;
+            out[0] = current;
+            out[1] = (unsigned char)count;
+            out += 2;
+            run -= count;
+        }
+    }
+
+    return result;
+}
+
+// Layout:
+//   FF FF FF FE      marker, not a valid size for the pair layout
+//   8 bytes          original size
+//   runs             header byte h, then
+//                      h < 128        h + 1 literal bytes
+//                      128 <= h < 255 one byte repeated h - 125 times (3-129)
+//                      h == 255       one byte, then (count - 130) as a
+//                                     7 bits per byte varint
+// Single pass: runs are found while writing, and the worst case only
+// grows by one header per 128 bytes, so no raw fallback is needed
+QByteArray RLECompressor::compressPackBits(const QByteArray& input) {
+    const unsigned char* data = (const unsigned char*)input.constData();
+    int n = input.size();
+
+    QByteArray result(PACKBITS_HEADER + n + n / PACKBITS_MAX_LITERAL + 16, 0);
+    unsigned char* out = (unsigned char*)result.data();
+    out[0] = 0xFF;
+    out[1] = 0xFF;
+    out[2] = 0xFF;
+    out[3] = 0xFE;
+    for(int k = 0; k < 8; k++) out[4 + k] = (unsigned char)(((qint64)n >> (k * 8)) & 0xFF);
+    out += PACKBITS_HEADER;
+
+    int literalStart = 0;
+    int i = 0;
+    while(i <= n) {
+        int run = (i < n) ? runLength(data + i, n - i) : 0;
+        if(i < n && run < PACKBITS_MIN_RUN) {
+            i += run;  // stays in the literal run
+            continue;
         }
 
-        result.append((char)current);
-        result.append((char)count);
-        i += count;
+        // flush pending literals before the repeat (or at the end)
+        while(literalStart < i) {
+            int count = i - literalStart;
+            if(count > PACKBITS_MAX_LITERAL) count = PACKBITS_MAX_LITERAL;
+            *out++ = (unsigned char)(count - 1);
+            memcpy(out, data + literalStart, count);
+            out += count;
+            literalStart += count;
+        }
+        if(i == n) break;
+
+        if(run <= PACKBITS_SHORT_RUN) {
+            *out++ = (unsigned char)(128 + run - PACKBITS_MIN_RUN);
+            *out++ = data[i];
+        } else {
+            *out++ = 255;
+            *out++ = data[i];
+            unsigned int extra = (unsigned int)(run - PACKBITS_SHORT_RUN - 1);
+            while(extra >= 0x80) {
+                *out++ = (unsigned char)(extra | 0x80);
+                extra >>= 7;
+            }
+            *out++ = (unsigned char)extra;
+        }
+        i += run;
+        literalStart = i;
     }
 
+    result.resize((int)(out - (unsigned char*)result.data()));
+    return result;
+}
+
+QByteArray RLECompressor::decompressPackBits(const QByteArray& input) {
+    if(input.size() < PACKBITS_HEADER) return QByteArray();
+    const unsigned char* in = (const unsigned char*)input.constData();
+    const unsigned char* inEnd = in + input.size();
+
+    qint64 origSize = 0;
+    for(int k = 0; k < 8; k++) origSize |= (qint64)in[4 + k] << (k * 8);
+    if(origSize <= 0 || origSize > 0x7FFFFFFF - 64) return QByteArray();
+    in += PACKBITS_HEADER;
+
+    // sized once, every run is checked against the end before it is written
+    QByteArray result;
+    result.resize((int)origSize);
+    unsigned char* out = (unsigned char*)result.data();
+    unsigned char* outEnd = out + origSize;
+
+    while(out < outEnd) {
+        if(in >= inEnd) return QByteArray();
+        unsigned char h = *in++;
+
+        if(h < 128) {
+            int count = h + 1;
+            if(count > inEnd - in || count > outEnd - out) return QByteArray();
+            memcpy(out, in, count);
+            in += count;
+            out += count;
+            continue;
+        }
+
+        if(in >= inEnd) return QByteArray();
+        unsigned char value = *in++;
+        qint64 count;
+        if(h < 255) {
+            count = h - 128 + PACKBITS_MIN_RUN;
+        } else {
+            qint64 extra = 0;
+            int shift = 0;
+            unsigned char b;
+            do {
+                if(in >= inEnd || shift > 28) return QByteArray();
+                b = *in++;
+                extra |= (qint64)(b & 0x7F) << shift;
+                shift += 7;
+            } while(b & 0x80);
+            count = extra + PACKBITS_SHORT_RUN + 1;
+        }
+        if(count > outEnd - out) return QByteArray();
+        memset(out, value, (size_t)count);
+        out += count;
+    }
+
+    if(in != inEnd) return QByteArray();
     return result;
 }
 
 QByteArray RLECompressor::decompress(const QByteArray& input) {
     if(input.size() < 4) return QByteArray();
 
+    // PackBits layout
+    if(input.size() >= PACKBITS_HEADER &&
+        (unsigned char)input[0] == 0xFF &&
+        (unsigned char)input[1] == 0xFF &&
+        (unsigned char)input[2] == 0xFF &&
+        (unsigned char)input[3] == 0xFE) {
+        return decompressPackBits(input);
+    }
+
     // check for uncompressed marker
     if(input.size() >= 8 &&
         (unsigned char)input[0] == 0xFF &&
@@ -93,35 +329,115 @@ QByteArray RLECompressor::decompress(const QByteArray& input) {
                    ((unsigned char)input[2] << 16) |
                    ((unsigned char)input[3] << 24);
 
-    if(origSize <= 0 || origSize > 100000000) {
+    // every pair gives at most 255 bytes, a bigger size is a broken header
+    if(origSize <= 0 || origSize > (qint64)(input.size() - 4) / 2 * 255) {
         return QByteArray();
     }
 
+    // output is sized once, each pair is one bounds check and one fill
     QByteArray result;
-    result.reserve(origSize);
+    result.resize(origSize);
+    unsigned char* out = (unsigned char*)result.data();
+    unsigned char* outEnd = out + origSize;
+
+    const unsigned char* in = (const unsigned char*)input.constData() + 4;
+    const unsigned char* inEnd = (const unsigned char*)input.constData() + input.size();
 
     // decompress: read char-count pairs
-    for(int i = 4; i < input.size(); i += 2) {
-        if(i + 1 >= input.size()) break;
+    while(inEnd - in >= 2 && out < outEnd) {
+        unsigned char ch = in[0];
+        int count = in[1];
+        in += 2;
 
-        unsigned char ch = input[i];
-        unsigned char count = input[i + 1];
+        if(count == 0) break;
 
-        if(count == 0 || count > 255) break;
+        // anything past the original size is dropped
+        if(count > outEnd - out) count = (int)(outEnd - out);
+        memset(out, ch, count);
+        out += count;
+    }
 
-        // repeat character count times
-        for(int j = 0; j < count; j++) {
-            result.append((char)ch);
+    if(out != outEnd) {
+        return QByteArray();
+    }
 
-            if(result.size() >= origSize) {
-                return result.left(origSize);
+    return result;
+}
+
+QByteArray RLECompressor::encodeZeroRuns(const QByteArray& input) {
+    const unsigned char* data = (const unsigned char*)input.constData();
+    int n = input.size();
+
+    // a run never takes more symbols than bytes, only 254/255 take two
+    QByteArray result(2 * n, 0);
+    unsigned char* out = (unsigned char*)result.data();
+
+    int i = 0;
+    while(i < n) {
+        if(data[i] == 0) {
+            int run = runLength(data + i, n - i);
+            i += run;
+
+            // digit 0 is worth 1 and digit 1 worth 2 at each position
+            unsigned int rest = (unsigned int)run - 1;
+            while(true) {
+                *out++ = (unsigned char)(rest & 1);
+                if(rest < 2) break;
+                rest = (rest - 2) / 2;
             }
+            continue;
+        }
+
+        unsigned char v = data[i++];
+        if(v < 254) {
+            *out++ = (unsigned char)(v + 1);
+        } else {
+            *out++ = 255;
+            *out++ = (unsigned char)(v - 254);
         }
     }
 
-    if(result.size() != origSize) {
-        return QByteArray();
+    result.resize((int)(out - (unsigned char*)result.data()));
+    return result;
+}
+
+QByteArray RLECompressor::decodeZeroRuns(const QByteArray& input, int originalSize) {
+    if(originalSize < 0) return QByteArray();
+
+    QByteArray result;
+    result.resize(originalSize);
+    unsigned char* out = (unsigned char*)result.data();
+    unsigned char* outEnd = out + originalSize;
+
+    const unsigned char* in = (const unsigned char*)input.constData();
+    const unsigned char* inEnd = in + input.size();
+
+    while(in < inEnd) {
+        if(*in < 2) {
+            // collect the digits of one run, then fill it in one go
+            qint64 run = 0;
+            qint64 weight = 1;
+            while(in < inEnd && *in < 2) {
+                run += (*in + 1) * weight;
+                weight <<= 1;
+                if(run > outEnd - out) return QByteArray();
+                in++;
+            }
+            memset(out, 0, (size_t)run);
+            out += run;
+            continue;
+        }
+
+        if(out >= outEnd) return QByteArray();
+        unsigned char s = *in++;
+        if(s < 255) {
+            *out++ = (unsigned char)(s - 1);
+        } else {
+            if(in >= inEnd || *in > 1) return QByteArray();
+            *out++ = (unsigned char)(254 + *in++);
+        }
     }
 
+    if(out != outEnd) return QByteArray();
     return result;
 }
@@ -4,12 +4,34 @@
 #include <QByteArray>
 
 class RLECompressor {
+private:
+    static const int PACKBITS_MIN_RUN = 3;       // shorter repeats stay literal
+    static const int PACKBITS_MAX_LITERAL = 128;
+    static const int PACKBITS_SHORT_RUN = 129;   // longest repeat in one header byte
+    static const int PACKBITS_HEADER = 12;       // marker + original size
+
+    bool packBits;  // literal / repeat runs instead of (char, count) pairs
+
+    QByteArray compressPackBits(const QByteArray& input);
+    QByteArray decompressPackBits(const QByteArray& input);
+
 public:
-    RLECompressor() {}
+    RLECompressor() : packBits(false) {}
     ~RLECompressor() {}
 
+    // PackBits style layout: one pass, bytes that don't repeat cost 1/128
+    // extra instead of doubling. decompress() reads every layout
+    void setPackBits(bool enabled) { packBits = enabled; }
+    bool getPackBits() const { return packBits; }
+
     QByteArray compress(const QByteArray& input);
     QByteArray decompress(const QByteArray& input);
+
+    // zero run stage for move-to-front output (bzip2 style): every run of
+    // zeros becomes its length in bijective base 2 with digits 0 and 1,
+    // other values v move up by one, 254 and 255 go out as 255 then 0 / 1
+    static QByteArray encodeZeroRuns(const QByteArray& input);
+    static QByteArray decodeZeroRuns(const QByteArray& input, int originalSize);
 };
 
 #endif
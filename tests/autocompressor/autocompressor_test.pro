@@ -0,0 +1,34 @@
+QT -= gui
+
+# testcase adds a "make check" target that runs the test
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = autocompressor_test
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../autocompressor.cpp \
+    ../../bwtcompressor.cpp \
+    ../../datastructures.cpp \
+    ../../huffmancompressor.cpp \
+    ../../huffmanpresets.cpp \
+    ../../lz77compressor.cpp \
+    ../../lzhuffmancompressor.cpp \
+    ../../lzwcompressor.cpp \
+    ../../ranscoder.cpp \
+    ../../rlecompressor.cpp
+
+HEADERS += \
+    ../../autocompressor.h \
+    ../../bwtcompressor.h \
+    ../../datastructures.h \
+    ../../huffmancompressor.h \
+    ../../huffmanpresets.h \
+    ../../lz77compressor.h \
+    ../../lzhuffmancompressor.h \
+    ../../lzwcompressor.h \
+    ../../ranscoder.h \
+    ../../rlecompressor.h
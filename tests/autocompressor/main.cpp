@@ -0,0 +1,181 @@
+// Checks that Auto mode picks the expected codec for each kind of input
+// and that chooseCodec() switches exactly at its cutoffs
+// build and run with: qmake && make check
+#include <cstdio>
+#include <cstring>
+#include "autocompressor.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// fixed seed so every run sees the same data
+static unsigned int seed = 12345;
+static unsigned int nextRandom() {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static int pick(const QByteArray& data) {
+    return AutoCompressor::chooseCodec(
+        AutoCompressor::analyze((const unsigned char*)data.constData(), data.size()));
+}
+
+static void expectCodec(const QByteArray& data, int codec, const char* what) {
+    int got = pick(data);
+    if(got != codec) {
+        printf("FAIL: %s picked %s, expected %s\n", what,
+               AutoCompressor::codecName(got), AutoCompressor::codecName(codec));
+        failures++;
+    }
+}
+
+// a few long runs of one byte each, like a mostly blank image
+static QByteArray makeRuns(int size) {
+    QByteArray data;
+    while(data.size() < size) {
+        char c = (char)(nextRandom() % 4);
+        int run = 500 + (int)(nextRandom() % 2000);
+        for(int i = 0; i < run && data.size() < size; i++) data.append(c);
+    }
+    return data;
+}
+
+// sentences out of a small vocabulary, words keep coming back
+static QByteArray makeText(int size) {
+    static const char* words[] = {
+        "the", "server", "request", "returned", "value", "record", "update",
+        "client", "timeout", "session", "while", "because", "status", "message",
+        "compression", "block", "stream", "header", "index", "buffer"
+    };
+    const int wordCount = sizeof(words) / sizeof(words[0]);
+    QByteArray data;
+    while(data.size() < size) {
+        data.append(words[nextRandom() % wordCount]);
+        data.append(nextRandom() % 10 == 0 ? '\n' : ' ');
+    }
+    data.resize(size);
+    return data;
+}
+
+// fixed size binary records, only a counter and one byte change
+static QByteArray makeRecords(int size) {
+    QByteArray data;
+    unsigned int id = 0;
+    while(data.size() < size) {
+        char record[16] = { (char)0x89, 0x01, 0x7F, (char)0xC0, 0, 0, 0, 0,
+                            (char)0xFE, (char)0xED, 0x00, 0x10, 0, 0, (char)0xA5, 0x5A };
+        memcpy(record + 4, &id, 4);
+        record[12] = (char)(nextRandom() & 0xFF);
+        id++;
+        data.append(record, 16);
+    }
+    data.resize(size);
+    return data;
+}
+
+// printable characters in no order, text without repeats
+static QByteArray makeNoisyText(int size) {
+    QByteArray data;
+    for(int i = 0; i < size; i++) data.append((char)(32 + nextRandom() % 95));
+    return data;
+}
+
+// 160 byte values in no order: skewed enough for huffman, no repeats
+static QByteArray makeSkewed(int size) {
+    QByteArray data;
+    for(int i = 0; i < size; i++) data.append((char)(96 + nextRandom() % 160));
+    return data;
+}
+
+static QByteArray makeRandom(int size) {
+    QByteArray data;
+    for(int i = 0; i < size; i++) data.append((char)(nextRandom() & 0xFF));
+    return data;
+}
+
+// stats that sit on no cutoff, each check moves one value across one
+static SampleStats neutralStats() {
+    SampleStats stats;
+    stats.entropy = 7.9;
+    stats.runFraction = 0.0;
+    stats.repeatFraction = 0.0;
+    stats.textFraction = 0.5;
+    stats.sampled = 4096;
+    return stats;
+}
+
+static void checkCutoffs() {
+    const double step = 0.001;
+    SampleStats stats;
+
+    stats = neutralStats();
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::STORED, "neutral stats are stored");
+    stats.sampled = 0;
+    stats.runFraction = 1.0;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::STORED, "nothing sampled is stored");
+
+    stats = neutralStats();
+    stats.runFraction = AutoCompressor::RLE_MIN_RUNS + step;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::RLE, "runs above cutoff pick RLE");
+    stats.runFraction = AutoCompressor::RLE_MIN_RUNS;
+    check(AutoCompressor::chooseCodec(stats) != AutoCompressor::RLE, "runs at cutoff don't pick RLE");
+
+    stats = neutralStats();
+    stats.textFraction = AutoCompressor::TEXT_MIN_FRACTION + step;
+    stats.repeatFraction = AutoCompressor::BWT_MIN_REPEATS + step;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::BWT, "repeating text picks BWT");
+    stats.textFraction = AutoCompressor::TEXT_MIN_FRACTION;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::LZ_HUFFMAN, "repeats that aren't text pick LZ77 + Huffman");
+    stats.textFraction = AutoCompressor::TEXT_MIN_FRACTION + step;
+    stats.repeatFraction = AutoCompressor::BWT_MIN_REPEATS;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::LZ_HUFFMAN, "text at BWT cutoff picks LZ77 + Huffman");
+
+    stats = neutralStats();
+    stats.repeatFraction = AutoCompressor::LZ_MIN_REPEATS + step;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::LZ_HUFFMAN, "repeats above cutoff pick LZ77 + Huffman");
+    stats.repeatFraction = AutoCompressor::LZ_MIN_REPEATS;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::STORED, "repeats at cutoff don't pick LZ77 + Huffman");
+
+    stats = neutralStats();
+    stats.entropy = AutoCompressor::HUFFMAN_MAX_ENTROPY - step;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::HUFFMAN, "entropy below cutoff picks Huffman");
+    stats.textFraction = AutoCompressor::TEXT_MIN_FRACTION + step;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::HUFFMAN_ORDER1, "text below cutoff picks order-1 Huffman");
+    stats.entropy = AutoCompressor::HUFFMAN_MAX_ENTROPY;
+    check(AutoCompressor::chooseCodec(stats) == AutoCompressor::STORED, "entropy at cutoff is stored");
+}
+
+int main() {
+    const int size = 1 << 20;
+
+    expectCodec(makeRuns(size), AutoCompressor::RLE, "runs");
+    expectCodec(makeText(size), AutoCompressor::BWT, "text");
+    expectCodec(makeRecords(size), AutoCompressor::LZ_HUFFMAN, "binary records");
+    expectCodec(makeNoisyText(size), AutoCompressor::HUFFMAN_ORDER1, "text without repeats");
+    expectCodec(makeSkewed(size), AutoCompressor::HUFFMAN, "skewed bytes");
+    expectCodec(makeRandom(size), AutoCompressor::STORED, "random");
+    expectCodec(QByteArray(), AutoCompressor::STORED, "empty");
+
+    // small inputs are looked at whole
+    expectCodec(makeText(3000), AutoCompressor::BWT, "short text");
+    expectCodec(makeRandom(3000), AutoCompressor::STORED, "short random");
+
+    checkCutoffs();
+
+    // whatever got picked has to come back unchanged
+    AutoCompressor autoCompressor;
+    QByteArray inputs[] = { makeRuns(size), makeText(size), makeRecords(size), makeRandom(size) };
+    for(int i = 0; i < 4; i++) {
+        QByteArray packed = autoCompressor.compress(inputs[i]);
+        check(autoCompressor.decompress(packed) == inputs[i], "round trip");
+    }
+
+    if(failures == 0) printf("all autocompressor checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Builds a Huffman preset (see huffmanpresets.h) from real sample files
+//
+// usage: trainpreset <id> <name> <file>...
+//        find <dir> -name '*.json' | trainpreset <id> <name> -
+//
+// "-" reads the file names from stdin, one per line, so big corpora
+// don't hit the argument limit. Every file adds at most MAX_SAMPLE_BYTES:
+// presets are for small payloads, a few huge files shouldn't outweigh
+// many small ones. The entry is printed in the layout huffmanpresets.cpp
+// uses, paste it over the old one
+#include <QFile>
+#include <cstdio>
+#include <cstring>
+#include "huffmancompressor.h"
+
+static const qint64 MAX_SAMPLE_BYTES = 1 << 16;
+
+static void addSample(const char* path, DynamicArray<QByteArray>& samples, qint64& total) {
+    QFile file(QString::fromLocal8Bit(path));
+    if(!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return;
+    }
+    QByteArray data = file.read(MAX_SAMPLE_BYTES);
+    if(data.isEmpty()) return;
+    total += data.size();
+    samples.add(data);
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        fprintf(stderr, "usage: trainpreset <id> <name> <file>... (- reads names from stdin)\n");
+        return 1;
+    }
+
+    DynamicArray<QByteArray> samples;
+    qint64 total = 0;
+    for(int i = 3; i < argc; i++) {
+        if(strcmp(argv[i], "-") != 0) {
+            addSample(argv[i], samples, total);
+            continue;
+        }
+
+        char line[4096];
+        while(fgets(line, sizeof(line), stdin)) {
+            int len = (int)strlen(line);
+            while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = 0;
+            if(len > 0) addSample(line, samples, total);
+        }
+    }
+    if(samples.size() == 0) {
+        fprintf(stderr, "no samples\n");
+        return 1;
+    }
+
+    HuffmanCompressor huffman;
+    QByteArray lengths = huffman.trainPreset(samples);
+
+    printf("    // %d files, %lld bytes\n", samples.size(), total);
+    printf("    { %s, \"%s\", {\n", argv[1], argv[2]);
+    for(int row = 0; row < 16; row++) {
+        printf("        ");
+        for(int col = 0; col < 16; col++) {
+            int c = row * 16 + col;
+            const char* after = (c == 255) ? "\n" : (col == 15) ? ",\n" : ", ";
+            printf("%2d%s", (unsigned char)lengths[c], after);
+        }
+    }
+    printf("    } },\n");
+    return 0;
+}
@@ -0,0 +1,22 @@
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# trains Huffman presets, see main.cpp for how to run it
+TARGET = trainpreset
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../datastructures.cpp \
+    ../../huffmancompressor.cpp \
+    ../../huffmanpresets.cpp \
+    ../../ranscoder.cpp
+
+HEADERS += \
+    ../../datastructures.h \
+    ../../huffmancompressor.h \
+    ../../huffmanpresets.h \
+    ../../ranscoder.h